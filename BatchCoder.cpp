@@ -0,0 +1,353 @@
+#include "BatchCoder.hpp"
+#include "BitInputStream.hpp"
+#include "BitOutputStream.hpp"
+#include "BlockReader.hpp"
+#include "ContextCoder.hpp"
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
+#include <fstream>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/** What a thread keeps from file to file: the code tree with its decode
+ *  table, the counts, and the buffers of the coded and decoded bytes
+ */
+struct BatchCoder::Worker {
+    HCTree tree;
+    bool hasTable;  // set while tree holds a copy of the shared table
+    std::vector<long> freqs;
+    std::vector<char> coded;
+    std::vector<byte> message;
+    Stats stats;
+
+    Worker() : hasTable(false), freqs(256) { }
+};
+
+/** Set up a batch coder using the given number of threads and codes
+ *  of at most codeLengthLimit bits.
+ */
+BatchCoder::BatchCoder(int threads, int codeLengthLimit) :
+    threads(threads), codeLengthLimit(codeLengthLimit), stats(0), table(0) { }
+
+BatchCoder::~BatchCoder() { }
+
+/** Add the time spent on every file, and the counts and code lengths
+ *  of its bytes, to stats.
+ */
+void BatchCoder::setStats(Stats* stats)
+{
+    this->stats = stats;
+}
+
+/** Compress every file with the shared table loaded into table, and
+ *  uncompress files coded with it.
+ */
+void BatchCoder::setTable(const HCTree* table)
+{
+    this->table = table;
+}
+
+/** Add a task for every line of the file listFile: an input file and
+ *  an output file separated by a tab, or by spaces.
+ *  Return false if listFile can't be read or a line has no output file.
+ */
+bool BatchCoder::readList(const std::string& listFile, std::vector<Task>& tasks)
+{
+    std::ifstream list(listFile.c_str());
+    if (!list)
+        return false;
+
+    std::string line;
+    while (std::getline(list, line))
+    {
+        //split at the tab, or else at the spaces
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+        size_t end = line.find('\t');
+        size_t start = end;
+        if (end == std::string::npos)
+        {
+            end = line.find(' ');
+            start = line.find_first_not_of(' ', end);
+        }
+        else
+            start = end + 1;
+        if (end == std::string::npos || start == std::string::npos)
+            return false;
+
+        Task task;
+        task.input = line.substr(0, end);
+        task.output = line.substr(start, line.find_last_not_of(" \r") + 1 - start);
+        task.size = 0;
+        tasks.push_back(task);
+    }
+
+    return true;
+}
+
+/** Add a task for every regular file in the directory inDir, writing
+ *  a file of the same name in outDir, which is created if missing.
+ *  Return false if either directory can't be opened.
+ */
+bool BatchCoder::readDirectory(const std::string& inDir, const std::string& outDir, std::vector<Task>& tasks)
+{
+    DIR* dir = opendir(inDir.c_str());
+    if (dir == nullptr)
+        return false;
+    struct stat st;
+    if (stat(outDir.c_str(), &st) != 0 ? mkdir(outDir.c_str(), 0755) != 0 : !S_ISDIR(st.st_mode))
+    {
+        closedir(dir);
+        return false;
+    }
+
+    //take the regular files in name order, so runs are repeatable
+    std::vector<std::string> names;
+    for (struct dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+    {
+        std::string path = inDir + "/" + entry->d_name;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+            names.push_back(entry->d_name);
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        Task task;
+        task.input = inDir + "/" + names[i];
+        task.output = outDir + "/" + names[i];
+        task.size = 0;
+        tasks.push_back(task);
+    }
+
+    return true;
+}
+
+/** Print message to the standard error, one thread at a time
+ */
+void BatchCoder::report(const std::string& message)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+    std::cerr << message << std::endl;
+}
+
+/** Write the n bytes at src to the file named path.
+ *  Return false if it can't be written.
+ */
+bool BatchCoder::writeFile(const std::string& path, const char* src, size_t n)
+{
+    std::filebuf wBuf;
+    if (!wBuf.open(path, std::ios::out | std::ios::binary))
+        return false;
+    bool ok = wBuf.sputn(src, n) == (std::streamsize)n;
+    return wBuf.close() != nullptr && ok;
+}
+
+/** Compress task.input into task.output with the tree and buffers of w.
+ *  Return false if compression failed.
+ */
+bool BatchCoder::compressFile(Worker& w, const Task& task)
+{
+    MappedFile rMap(task.input);
+    if (!rMap.isMapped())
+    {
+        this->report("Error. " + task.input + " couldn't be opened. Compression failed.");
+        return false;
+    }
+
+    //code straight into the buffer of the last file, which keeps its
+    //capacity, then write it out at once
+    w.coded.clear();
+    BitOutputStream out(w.coded);
+    if (this->table != nullptr)
+    {
+        //code with the worker's copy of the shared table, made once
+        if (!w.hasTable)
+            w.tree = *this->table;
+        w.hasTable = true;
+        w.tree.setStats(this->stats ? &w.stats : nullptr);
+        w.tree.compressShared(out, rMap.data(), rMap.size());
+    }
+    else
+    {
+        //build the code from the mapped bytes, with the tree of the last file
+        w.tree.reset();
+        w.tree.setCodeLengthLimit(this->codeLengthLimit);
+        w.tree.setStats(this->stats ? &w.stats : nullptr);
+        std::fill(w.freqs.begin(), w.freqs.end(), 0);
+        w.tree.build(w.freqs, rMap.data(), rMap.size());
+        w.tree.compress(out, rMap.data(), rMap.size());
+    }
+
+    double start = this->stats ? Stats::now() : 0;
+    bool ok = writeFile(task.output, w.coded.data(), w.coded.size());
+    if (this->stats != nullptr)
+        w.stats.seconds[Stats::IO] += Stats::now() - start;
+
+    if (!ok)
+        this->report("Error. " + task.output + " couldn't be written. Compression of " + task.input + " failed.");
+    return ok;
+}
+
+/** Uncompress task.input into task.output with the tree and buffers of w.
+ *  Return false if uncompression failed.
+ */
+bool BatchCoder::uncompressFile(Worker& w, const Task& task)
+{
+    MappedFile rMap(task.input);
+    if (!rMap.isMapped())
+    {
+        this->report("Error. " + task.input + " couldn't be opened. Uncompression failed.");
+        return false;
+    }
+    BitInputStream in(reinterpret_cast<const char*>(rMap.data()), rMap.size());
+    int format = HCTree::readFormat(in);
+    int version = format & ~(HCTree::FORMAT_CHECKSUM | HCTree::FORMAT_INDEX);
+
+    bool ok;
+    if (version == HCTree::FORMAT_BLOCKED || version == HCTree::FORMAT_STREAMS)
+    {
+        //blocked files carry a code in every block, the reader decodes
+        //them all into the buffer of the last file
+        double start = this->stats ? Stats::now() : 0;
+        BlockReader reader(rMap.data(), rMap.size());
+        ok = reader.isValid();
+        if (ok)
+        {
+            w.message.resize(reader.messageSize());
+            ok = reader.read(0, reader.messageSize(), w.message.data());
+        }
+        if (this->stats != nullptr)
+        {
+            w.stats.seconds[Stats::CODE] += Stats::now() - start;
+            w.stats.messageBytes += w.message.size();
+        }
+    }
+    else if (format == HCTree::FORMAT_CONTEXT)
+    {
+        //the context format has a code per cluster of contexts
+        ContextCoder coder;
+        coder.setStats(this->stats ? &w.stats : nullptr);
+        ok = coder.readHeader(in);
+        if (ok)
+        {
+            w.message.resize(coder.messageSize());
+            ok = coder.decompress(in, w.message.data(), w.message.size());
+        }
+    }
+    else
+    {
+        //read the code of the file into the tree of the last file, or
+        //use the worker's copy of the shared table, then decode into
+        //the buffer of the last file
+        if (format == HCTree::FORMAT_SHARED && this->table != nullptr)
+        {
+            if (!w.hasTable)
+                w.tree = *this->table;
+            w.hasTable = true;
+        }
+        else
+        {
+            w.tree.reset();
+            w.hasTable = false;
+        }
+        w.tree.setStats(this->stats ? &w.stats : nullptr);
+        std::fill(w.freqs.begin(), w.freqs.end(), 0);
+        ok = w.tree.build2(w.freqs, in, format);
+
+        //every byte takes a bit at least, unless the code has a single
+        //byte, so a size the file can't hold is damage, not a buffer
+        //to allocate
+        long size = w.tree.messageSize();
+        if (ok && (size < 0 || (w.tree.leafCount() > 1 && (uint64_t)size > 8 * (uint64_t)rMap.size())))
+            ok = false;
+        if (ok)
+        {
+            w.message.resize(w.tree.messageSize());
+            ok = w.tree.decompress(in, w.message.data(), w.message.size());
+        }
+    }
+    if (!ok)
+    {
+        this->report("Error. " + task.input + " is damaged or in an unknown format. Uncompression failed.");
+        return false;
+    }
+
+    double start = this->stats ? Stats::now() : 0;
+    ok = writeFile(task.output, reinterpret_cast<const char*>(w.message.data()), w.message.size());
+    if (this->stats != nullptr)
+    {
+        w.stats.seconds[Stats::IO] += Stats::now() - start;
+        w.stats.codedBytes += rMap.size();
+    }
+
+    if (!ok)
+        this->report("Error. " + task.output + " couldn't be written. Uncompression of " + task.input + " failed.");
+    return ok;
+}
+
+/** Compress, or uncompress if compressing isn't set, every task,
+ *  largest input first.
+ *  Return the number of tasks that failed.
+ */
+size_t BatchCoder::run(std::vector<Task>& tasks, bool compressing)
+{
+    //start the largest files first, so the small ones fill in around them
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        struct stat st;
+        tasks[i].size = stat(tasks[i].input.c_str(), &st) == 0 ? st.st_size : 0;
+    }
+    std::stable_sort(tasks.begin(), tasks.end(),
+                     [](const Task& a, const Task& b) { return a.size > b.size; });
+
+    //one worker for every thread, handed to whichever file runs next
+    ThreadPool pool(this->threads);
+    for (int i = 0; i < pool.size(); i++)
+        this->idle.push_back(std::unique_ptr<Worker>(new Worker()));
+
+    std::vector<char> ok(tasks.size());
+    std::vector<std::future<void> > done;
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        done.push_back(pool.submit([this, &tasks, &ok, i, compressing]() {
+            std::unique_ptr<Worker> w;
+            {
+                std::lock_guard<std::mutex> guard(this->lock);
+                w = std::move(this->idle.back());
+                this->idle.pop_back();
+            }
+
+            //a file that can't be coded fails on its own, without
+            //taking the rest of the batch down with it
+            try
+            {
+                ok[i] = compressing ? this->compressFile(*w, tasks[i]) : this->uncompressFile(*w, tasks[i]);
+            }
+            catch (const std::exception&)
+            {
+                ok[i] = false;
+                this->report(compressing ? "Error. " + tasks[i].input + " couldn't be coded. Compression failed."
+                                         : "Error. " + tasks[i].input +
+                                               " is damaged or in an unknown format. Uncompression failed.");
+            }
+
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->idle.push_back(std::move(w));
+        }));
+    }
+    for (size_t i = 0; i < done.size(); i++)
+        done[i].get();
+
+    //add up the stats of the workers
+    if (this->stats != nullptr)
+    {
+        for (size_t i = 0; i < this->idle.size(); i++)
+            this->stats->add(this->idle[i]->stats);
+    }
+    this->idle.clear();
+
+    return std::count(ok.begin(), ok.end(), 0);
+}
@@ -0,0 +1,104 @@
+#ifndef BATCHCODER_HPP
+#define BATCHCODER_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include "HCTree.hpp"
+#include "Stats.hpp"
+
+/** A class for compressing or uncompressing many files in one run, like
+ *  a list of file pairs or every file of a directory, without starting
+ *  a process per file.
+ *  The files are spread over one pool of threads, largest first, so a
+ *  large file found last doesn't hold up the end of the run. Every
+ *  thread keeps its code tree, counts and buffers from file to file,
+ *  and codes straight into its buffer, so once the buffers have grown
+ *  to the largest file so far, a file allocates no buffers of its own.
+ *  Files are compressed in the canonical single-table format, the same
+ *  as compress writes for one regular file, or with a shared table if
+ *  there is one, and uncompressed from any format.
+ */
+class BatchCoder {
+public:
+    /** A file to code and where to write the result
+     */
+    struct Task {
+        std::string input;   // the file to read
+        std::string output;  // the file to write
+        uint64_t size;       // the number of bytes in input, for the schedule
+    };
+
+private:
+    struct Worker;
+
+    int threads;          // number of worker threads, below 1 for all cores
+    int codeLengthLimit;  // longest code of a file
+    Stats* stats;         // where the time and code statistics go, if anywhere
+    const HCTree* table;  // the shared table to code with, if any
+
+    std::vector<std::unique_ptr<Worker> > idle;  // workers not coding a file right now
+    std::mutex lock;                             // guards idle and the error messages
+
+    /** Compress task.input into task.output with the tree and buffers of w.
+     *  Return false if compression failed.
+     */
+    bool compressFile(Worker& w, const Task& task);
+
+    /** Uncompress task.input into task.output with the tree and buffers of w.
+     *  Return false if uncompression failed.
+     */
+    bool uncompressFile(Worker& w, const Task& task);
+
+    /** Write the n bytes at src to the file named path.
+     *  Return false if it can't be written.
+     */
+    static bool writeFile(const std::string& path, const char* src, size_t n);
+
+    /** Print message to the standard error, one thread at a time
+     */
+    void report(const std::string& message);
+
+public:
+    /** Set up a batch coder using the given number of threads, below 1
+     *  for one per hardware thread, and codes of at most codeLengthLimit
+     *  bits, 0 for no limit.
+     */
+    BatchCoder(int threads, int codeLengthLimit = HCTree::MAX_HEADER_CODE_LENGTH);
+
+    ~BatchCoder();
+
+    /** Add the time spent on every file, and the counts and code lengths
+     *  of its bytes, to stats.
+     */
+    void setStats(Stats* stats);
+
+    /** Compress every file with the shared table loaded into table
+     *  (HCTree::readTable), and uncompress files coded with it.
+     *  PRECONDITION: table outlives the calls to run.
+     */
+    void setTable(const HCTree* table);
+
+    /** Add a task for every line of the file listFile, which holds an
+     *  input file and an output file separated by a tab, or by spaces if
+     *  the names have none. Empty lines are skipped.
+     *  Return false if listFile can't be read or a line has no output file.
+     */
+    static bool readList(const std::string& listFile, std::vector<Task>& tasks);
+
+    /** Add a task for every regular file in the directory inDir, writing
+     *  a file of the same name in outDir, which is created if missing.
+     *  Return false if either directory can't be opened.
+     */
+    static bool readDirectory(const std::string& inDir, const std::string& outDir, std::vector<Task>& tasks);
+
+    /** Compress, or uncompress if compressing isn't set, every task,
+     *  largest input first.
+     *  Return the number of tasks that failed.
+     */
+    size_t run(std::vector<Task>& tasks, bool compressing);
+};
+
+#endif // BATCHCODER_HPP
@@ -4,71 +4,158 @@
  */
 int BitInputStream::readBit()
 {
-    //if buffer is 0, flush the buffer before writing the next bit
-    if (this->bufi == 0)
-        this->fillBuf();
-
-    //set the correct bit in the mask to 1
-    unsigned char mask = pow(2,(this->bufi -  1));
+    //read a single bit from the top of the buffer
+    return (int)this->readBits(1);
+}
 
-    //and the mask with the buffer to get the bit value
-    int bit = this->buf & mask;
+/** Implementation of readByte
+ */
+int BitInputStream::readByte()
+{
+    //if there aren't 8 more bits in the stream, return -1
+    if (this->bufi < 8)
+        this->fillBuf();
+    if (this->bufi < 8)
+        return -1;
 
-    //shift the bit value to the least significant bit position
-    bit >>= (this->bufi - 1);
+    //else return the next 8 bits
+    return (int)this->readBits(8);
+}
 
-    //decrement the bit buffer index
-    this->bufi--;
+/** Implementation of readLong
+ */
+long BitInputStream::readLong()
+{
+    //read the bytes of the long in memory order
+    long l;
+    unsigned char* bytes = reinterpret_cast<unsigned char*>(&l);
+    for (size_t i = 0; i < sizeof(long); i++)
+    {
+        //if EOF, return -1
+        int c = this->readByte();
+        if (c == -1)
+            return -1;
+        bytes[i] = c;
+    }
 
-    //return the result
-    return bit;
+    return l;
 }
 
-/** Implementation of readByte
+/** Implementation of readVarint
  */
-int BitInputStream::readByte()
+long BitInputStream::readVarint()
 {
-    //if EOF, return -1, else return the next
-    //byte from the stream
-    if (this->in.eof())
-        return -1;
-    else
+    long v = 0;
+
+    //add 7 bits at a time until a byte without the top bit
+    for (int shift = 0; shift < 64; shift += 7)
     {
-        int c = this->in.get();
-        return c;
+        //if EOF, return -1
+        int c = this->readByte();
+        if (c == -1)
+            return -1;
+
+        v |= (long)(c & 127) << shift;
+        if (c < 128)
+            break;
     }
 
+    return v;
 }
 
-/** Implementation of readLong
+/** Implementation of readBytes
  */
-long BitInputStream::readLong()
+size_t BitInputStream::readBytes(char* dst, size_t n)
 {
-    //if EOF, return -1, else return the next
-    //4 bytes from the stream
-    if (this->in.eof())
-        return -1;
-    else
+    size_t done = 0;
+
+    //first hand out the whole bytes still in the bit buffer
+    while (done < n && this->bufi >= 8)
+        dst[done++] = (char)this->readBits(8);
+
+    //then copy straight from the block, reading more blocks as needed
+    while (done < n)
     {
-        long l;
-        this->in.read(reinterpret_cast<char*>(&l),sizeof(long));
-        return l;
+        if (this->blocki == this->blockn && !this->readBlock())
+            break;
+
+        size_t take = std::min(n - done, this->blockn - this->blocki);
+        std::copy(this->block + this->blocki, this->block + this->blocki + take, dst + done);
+        this->blocki += take;
+        done += take;
     }
+
+    return done;
+}
+
+/** Return the number of bytes read from the start of the stream.
+ *  PRECONDITION: the stream is at a byte boundary.
+ */
+size_t BitInputStream::position() const
+{
+    //the bytes taken from the blocks, less the ones still in the bit buffer
+    return this->blockStart + this->blocki - std::max(this->bufi, 0) / 8;
 }
 
-/** If the bit buffer contains any bits, flush the bit buffer to the ostream,
- *  clear the bit buffer, and set the bit buffer index to 0.
+/** Read the next block of bytes from the istream.
+ *  Return false if the istream has no more bytes.
+ */
+bool BitInputStream::readBlock()
+{
+    //bytes in memory have no more blocks
+    if (this->in == nullptr)
+        return false;
+
+    //read as much as the block holds, after the bytes of the last block
+    this->blockStart += this->blockn;
+    this->in->read(&this->storage[0], BLOCK_SIZE);
+    this->block = &this->storage[0];
+    this->blockn = this->in->gcount();
+    this->blocki = 0;
+
+    return this->blockn > 0;
+}
+
+/** Top up the bit buffer from the block buffer until it holds at
+ *  least 57 bits, reading the next block from the istream as needed.
  */
 void BitInputStream::fillBuf()
 {
-    //if the buffer is totally full, write the byte
-    //to the output file
-    if (this->bufi == 0)
+    //bits consumed past the end of the stream are gone for good
+    if (this->bufi < 0)
+        this->bufi = 0;
+
+    while (this->bufi <= 56)
     {
-        //write the buffer to the output file
-        this->in.get(buf);
+        //if the block holds at least 8 more bytes, add as many
+        //of them as fit in the buffer at once
+        if (this->blockn - this->blocki >= 8)
+        {
+            //load the next 8 bytes, first byte in the msb
+            const unsigned char* src =
+                reinterpret_cast<const unsigned char*>(this->block + this->blocki);
+            uint64_t bytes = 0;
+            for (int k = 0; k < 8; k++)
+                bytes = (bytes << 8) | src[k];
+
+            //place the whole bytes that fit directly below the buffered bits
+            int nbytes = (64 - this->bufi) >> 3;
+            this->buf |= bytes >> this->bufi;
+            this->blocki += nbytes;
+            this->bufi += 8 * nbytes;
+
+            //clear the bits of the byte that only partially fit
+            if (this->bufi < 64)
+                this->buf &= ~(~0ULL >> this->bufi);
+            return;
+        }
+
+        //near the end of the block, add one byte at a time
+        if (this->blocki == this->blockn && !this->readBlock())
+            return;
 
-        //reinitialize the buffer and buffer index
-        this->bufi = 8;
+        unsigned char c = this->block[this->blocki++];
+        this->buf |= (uint64_t)c << (56 - this->bufi);
+        this->bufi += 8;
     }
 }
@@ -2,53 +2,148 @@
 #define BITINPUTSTREAM_HPP
 
 #include <iostream>
-#include <bitset>
-#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
 
 using namespace std;
 
-/** A class for reading bits (and ints) from an istream
+/** A class for reading bits (and ints) from an istream, or from
+ *  bytes already in memory.
+ *  The istream is read a large block at a time, and bits are served
+ *  from a 64-bit container refilled from that block, so the next bits
+ *  of the stream can be looked at before they are consumed.
+ *  Since whole blocks are read ahead, the istream must not be read
+ *  from anywhere else once it is handed to a BitInputStream.
  */
 class BitInputStream {
 private:
-    istream& in;  // the istream to delegate to
-    char buf;     // the buffer of bits
-    int bufi;     // the bit buffer index
+    istream* in;                // the istream to delegate to, or null for memory
+    uint64_t buf;               // the buffer of bits, next bit in the msb
+    int bufi;                   // the number of valid bits in the buffer
+    std::vector<char> storage;  // the block buffer for reading the istream
+    const char* block;          // the block of bytes bits are taken from
+    size_t blocki;              // the index of the next unused byte in block
+    size_t blockn;              // the number of bytes in block
+    size_t blockStart;          // the number of bytes of the stream before block
+
+    /** Read the next block of bytes from the istream.
+     *  Return false if the istream has no more bytes.
+     */
+    bool readBlock();
 
 public:
+    /** Size of the block buffer in bytes
+     */
+    static const size_t BLOCK_SIZE = 256 * 1024;
+
     /** Initialize a BitInputStream object, given an istream.
     */
-    BitInputStream(istream& s) : in(s), buf(0), bufi(0) { }
+    BitInputStream(istream& s) :
+        in(&s), buf(0), bufi(0), storage(BLOCK_SIZE), block(&storage[0]),
+        blocki(0), blockn(0), blockStart(0) { }
+
+    /** Initialize a BitInputStream object reading the n bytes at data.
+     *  The bytes are read in place, so they must outlive the stream.
+     */
+    BitInputStream(const char* data, size_t n) :
+        in(0), buf(0), bufi(0), block(data), blocki(0), blockn(n), blockStart(0) { }
 
     /** Read the next bit from the bit buffer.
      *  If the bit buffer is currently empty,
-     *  fill the bit buffer by reading a char from the istream first.
+     *  fill the bit buffer by reading from the istream first.
      *  Return the bit read as the least signficant bit of an int.
-     *  Return -1 on EOF.
      *  This must be consistent with BitOutputStream::writeBit(), in terms
      *  of ordering of bits in the stream.
      */
     int readBit();
 
-    /** Read a byte from the istream.
+    /** Return the next n bits (1 <= n <= 57) of the stream as the least
+     *  significant bits of the result, first bit in the most significant
+     *  position, without consuming them.
+     *  Bits past the end of the istream read as 0.
+     */
+    uint64_t peekBits(int n);
+
+    /** Drop the next n bits from the bit buffer.
+     *  PRECONDITION: peekBits(m) was called with m >= n since the last
+     *  call to consumeBits, so the bits are already in the buffer.
+     */
+    void consumeBits(int n);
+
+    /** Read and return the next n bits (1 <= n <= 57) of the stream,
+     *  same as peekBits followed by consumeBits.
+     */
+    uint64_t readBits(int n);
+
+    /** Read the next 8 bits of the stream as a byte.
      *  Return -1 on EOF.
-     *  This function doesn't touch the bit buffer.
      *  The client has to manage interaction between reading bits
-     *  and reading bytes.
+     *  and reading bytes: bytes read after a partial byte of bits
+     *  are not aligned.
      */
     int readByte();
 
-    /** Read a non-negative long from the istream.
+    /** Read a non-negative long stored in native byte order.
      *  Return -1 on EOF.
-     *  This function doesn't touch the bit buffer.
      *  The client has to manage interaction between reading bits
-     *  and reading ints.
+     *  and reading ints, as for readByte.
      */
     long readLong();
 
-    /** If the bit buffer is empty, fill it with the next 8 bits
+    /** Read up to n bytes into dst and return the number of bytes read,
+     *  which is less than n only at EOF.
+     *  PRECONDITION: the stream is at a byte boundary.
+     */
+    size_t readBytes(char* dst, size_t n);
+
+    /** Read a non-negative long written by BitOutputStream::writeVarint.
+     *  Return -1 on EOF.
+     *  The client has to manage interaction between reading bits
+     *  and reading ints, as for readByte.
+     */
+    long readVarint();
+
+    /** Return the number of bytes read from the start of the stream.
+     *  PRECONDITION: the stream is at a byte boundary.
+     */
+    size_t position() const;
+
+    /** Top up the bit buffer from the block buffer until it holds at
+     *  least 57 bits, reading the next block from the istream as needed.
+     *  At the end of the istream the buffer may hold fewer bits.
      */
     void fillBuf();
 };
 
+/** Implementation of peekBits
+ */
+inline uint64_t BitInputStream::peekBits(int n)
+{
+    //make sure the buffer holds at least n bits
+    if (this->bufi < n)
+        this->fillBuf();
+
+    //the next n bits sit at the top of the buffer
+    return this->buf >> (64 - n);
+}
+
+/** Implementation of consumeBits
+ */
+inline void BitInputStream::consumeBits(int n)
+{
+    //shift the consumed bits out of the top of the buffer
+    this->buf <<= n;
+    this->bufi -= n;
+}
+
+/** Implementation of readBits
+ */
+inline uint64_t BitInputStream::readBits(int n)
+{
+    uint64_t bits = this->peekBits(n);
+    this->consumeBits(n);
+    return bits;
+}
+
 #endif // BITINPUTSTREAM_HPP
@@ -1,74 +1,168 @@
 #include "BitOutputStream.hpp"
 
-/** Write the least significant bit of the argument into
- *  the bit buffer, and increment the bit buffer index.
- *  Flush to the ostream first if the bit buffer is full.
- *  This must be consistent with BitInputStream::readBit().
+/** Write out anything still buffered
  */
-void BitOutputStream::writeBit(int bit)
+BitOutputStream::~BitOutputStream()
 {
-    //if buffer is 0, flush the buffer before writing the next bit
-    if (this->bufi == 0)
+    //only touch the ostream if there is something left to write, a
+    //vector always drops its slack
+    if (this->bufi > 0 || this->blocki > 0)
         this->flush();
+    else if (this->sink != nullptr)
+        this->writeBlock();
+}
+
+/** Move the whole bytes of the accumulator to the block buffer,
+ *  handing the block buffer to the ostream first if it is full.
+ */
+void BitOutputStream::flushBits()
+{
+    //if the block buffer can't take another 8 bytes, make room
+    if (this->blocki + 8 > this->blockLimit)
+        this->makeRoom(8);
+
+    //store the accumulator first byte first, then keep only the
+    //bytes that are complete (the block has 8 bytes of slack)
+    char* dst = this->blockData + this->blocki;
+    for (int k = 0; k < 8; k++)
+        dst[k] = (char)(this->buf >> (56 - 8 * k));
 
-    //if bit is 0, just decrement the buffer index because it is initialized
-    //to all zeros and thus the value is already implicitly there
-    if (bit == 0)
-        this->bufi--;
+    int nbytes = this->bufi >> 3;
+    this->blocki += nbytes;
+
+    //shift the stored bytes out of the accumulator
+    this->buf = (nbytes == 8) ? 0 : (this->buf << (8 * nbytes));
+    this->bufi -= 8 * nbytes;
+}
+
+/** Write the block buffer to the ostream and empty it. A vector
+ *  already holds the bytes, and only drops the slack after them.
+ */
+void BitOutputStream::writeBlock()
+{
+    if (this->sink != nullptr)
+    {
+        this->sinkBase += this->blocki;
+        this->written += this->blocki;
+        this->sink->resize(this->sinkBase);
+        this->blockData = this->sink->data() + this->sinkBase;
+        this->blockLimit = 0;
+    }
     else
+        this->put(this->blockData, this->blocki);
+    this->blocki = 0;
+}
+
+/** Make room for n more bytes in the block buffer, by writing it
+ *  out, or by growing the vector it is in.
+ */
+void BitOutputStream::makeRoom(size_t n)
+{
+    if (this->sink == nullptr)
     {
-        //set the correct bit in the mask to 1
-        char mask = pow(2,(this->bufi -  1));
+        this->writeBlock();
+        return;
+    }
 
-        //or the mask with the buffer to add the value to the buffer
-        this->buf = this->buf | mask;
+    //grow the vector at least twofold, keeping 8 bytes of slack
+    size_t need = this->sinkBase + this->blocki + n + 8;
+    this->sink->resize(std::max(need, std::max(2 * this->sink->size(), (size_t)64)));
+    this->blockData = this->sink->data() + this->sinkBase;
+    this->blockLimit = this->sink->size() - this->sinkBase - 8;
+}
 
-        //decrement the buffer index
-        this->bufi--;
+/** Hand the n bytes at src to the ostream or the fixed buffer,
+ *  whichever this stream writes to.
+ */
+void BitOutputStream::put(const char* src, size_t n)
+{
+    if (this->out != nullptr)
+        this->out->write(src, n);
+    else
+    {
+        //copy what still fits, and remember if anything didn't
+        size_t fits = std::min(n, this->capacity - this->written);
+        std::copy(src, src + fits, this->fixed + this->written);
+        this->overflow = this->overflow || fits < n;
+        n = fits;
     }
+    this->written += n;
 }
 
-/** Write the least significant byte of the argument to the ostream.
- *  This function doesn't touch the bit buffer.
+/** Write the least significant byte of the argument.
  *  The client has to manage interaction between writing bits
  *  and writing bytes.
  */
 void BitOutputStream::writeByte(int b)
 {
-    //create a mask to obscure the last three bytes in the int
-    const char MASK = 255;
-
-    //convert that int to a char
-    char myByte = b & MASK;
-
-    //write the char (1 byte) to the ostream
-    this->out.put(myByte);
+    //write the low 8 bits of the int
+    this->writeBits(b & 255, 8);
 }
 
-/** Write the argument to the ostream.
- *  This function doesn't touch the bit buffer.
+/** Write the argument in native byte order.
  *  The client has to manage interaction between writing bits
  *  and writing ints.
  */
 void BitOutputStream::writeLong(long l)
 {
-    //write a long to the ostream
-    this->out.write(reinterpret_cast<const char*>(&l), sizeof(long));
+    //write the bytes of the long in memory order
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&l);
+    for (size_t i = 0; i < sizeof(long); i++)
+        this->writeByte(bytes[i]);
+}
+
+/** Write the argument as a variable length integer: 7 bits per byte,
+ *  least significant first, with the top bit set on all but the last.
+ */
+void BitOutputStream::writeVarint(uint64_t v)
+{
+    //write 7 bits at a time while more follow
+    while (v >= 128)
+    {
+        this->writeByte((v & 127) | 128);
+        v >>= 7;
+    }
+
+    //write the last 7 bits
+    this->writeByte(v);
+}
+
+/** Write the n bytes at src.
+ *  PRECONDITION: the stream is at a byte boundary.
+ */
+void BitOutputStream::writeBytes(const char* src, size_t n)
+{
+    //move the bytes still in the accumulator to the block buffer
+    this->flushBits();
+
+    //if the bytes don't fit in the block buffer, make room first
+    if (this->blocki + n > this->blockLimit)
+        this->makeRoom(n);
+
+    //large runs of bytes go straight to the destination, a vector
+    //always has room for them
+    if (n > this->blockLimit)
+        this->put(src, n);
+    else
+    {
+        std::copy(src, src + n, this->blockData + this->blocki);
+        this->blocki += n;
+    }
 }
 
-/** If the bit buffer contains any bits, flush the bit buffer to the ostream,
- *  clear the bit buffer, and set the bit buffer index to 8.
- *  Also flush the ostream itself.
+/** Pad the bit buffer with 0 bits up to a whole byte, write all
+ *  buffered bytes to the ostream (or vector) and flush the ostream itself.
  */
 void BitOutputStream::flush()
 {
-    //write the buffer to the output file
-    this->out.put(buf);
+    //round a partial byte up, the padding bits are already 0
+    this->padToByte();
 
-    //reset the bit buffer and it's index
-    this->bufi = 8;
-    this->buf = 0;
+    //move the accumulator to the block buffer and write that out
+    this->flushBits();
+    this->writeBlock();
 
     //flush the ostream
-    out.flush();
+    if (this->out != nullptr)
+        this->out->flush();
 }
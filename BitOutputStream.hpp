@@ -2,48 +2,185 @@
 #define BITOUTPUTSTREAM_HPP
 
 #include <cstdlib>
+#include <cstdint>
 #include <iostream>
 #include <bitset>
-#include <cmath>
+#include <vector>
+#include <algorithm>
 
-/** A class for writing bits (and chars and ints) to an ostream
+/** A class for writing bits (and chars and ints) to an ostream, to
+ *  the end of a vector of bytes in memory, or to a fixed size buffer.
+ *  Bits are collected in a 64-bit accumulator, whole bytes are moved
+ *  to a block buffer, and the block buffer is only handed to the ostream
+ *  when it fills up or the stream is flushed.
+ *  A vector is its own block buffer: it grows as bytes come in, so
+ *  nothing is staged or copied, and a reused vector allocates nothing.
  */
 class BitOutputStream {
 
 private:
-  std::ostream& out;  // the ostream to delegate to
-  char buf;     // the buffer of bits
-  int bufi;     // the bit buffer index
+  std::ostream* out;        // the ostream to delegate to, or null for memory
+  std::vector<char>* sink;  // the vector written to if there is no ostream
+  char* fixed;              // the buffer written to if there is neither
+  size_t capacity;          // the size of the fixed buffer
+  bool overflow;            // set once a byte didn't fit the fixed buffer
+  uint64_t buf;             // the bit accumulator, first bit in the msb
+  int bufi;                 // the number of bits in the accumulator
+  std::vector<char> block;  // the buffer of whole bytes, unless writing to a vector
+  char* blockData;          // the block buffer, block or the end of the vector
+  size_t blocki;            // the number of bytes in the block buffer
+  size_t blockLimit;        // the number of bytes the block buffer takes before it is written
+  size_t sinkBase;          // the offset of the block buffer in the vector
+  size_t written;           // the number of bytes handed to the destination
+
+  /** Move the whole bytes of the accumulator to the block buffer,
+   *  handing the block buffer to the ostream first if it is full.
+   */
+  void flushBits();
+
+  /** Write the block buffer to the ostream and empty it. A vector
+   *  already holds the bytes, and only drops the slack after them.
+   */
+  void writeBlock();
+
+  /** Make room for n more bytes in the block buffer, by writing it
+   *  out, or by growing the vector it is in.
+   */
+  void makeRoom(size_t n);
+
+  /** Hand the n bytes at src to the ostream or the fixed buffer,
+   *  whichever this stream writes to.
+   */
+  void put(const char* src, size_t n);
 
 public:
-  BitOutputStream(std::ostream& s) : out(s), buf(0), bufi(8) { }
+  /** Size of the block buffer in bytes
+   */
+  static const size_t BLOCK_SIZE = 256 * 1024;
+
+  BitOutputStream(std::ostream& s) :
+      out(&s), sink(0), fixed(0), capacity(0), overflow(false), buf(0), bufi(0),
+      block(BLOCK_SIZE + 8), blockData(&block[0]), blocki(0), blockLimit(BLOCK_SIZE),
+      sinkBase(0), written(0) { }
+
+  /** Initialize a BitOutputStream object appending to the vector v.
+   *  The bytes are written in place, with some slack after them until
+   *  the stream is flushed or destroyed, so v must not be read or
+   *  changed before then.
+   */
+  BitOutputStream(std::vector<char>& v) :
+      out(0), sink(&v), fixed(0), capacity(0), overflow(false), buf(0), bufi(0),
+      blockData(v.data() + v.size()), blocki(0), blockLimit(0), sinkBase(v.size()), written(0) { }
+
+  /** Initialize a BitOutputStream object writing to the cap bytes at dst.
+   *  Bytes past the end of the buffer are dropped and overflowed()
+   *  is set. The block buffer is no larger than the destination, so
+   *  small buffers stay cheap to write to.
+   */
+  BitOutputStream(char* dst, size_t cap) :
+      out(0), sink(0), fixed(dst), capacity(cap), overflow(false), buf(0), bufi(0),
+      block((cap < BLOCK_SIZE ? std::max(cap, (size_t)8) : BLOCK_SIZE) + 8), blockData(&block[0]), blocki(0),
+      blockLimit(cap < BLOCK_SIZE ? std::max(cap, (size_t)8) : BLOCK_SIZE), sinkBase(0), written(0) { }
+
+  /** Write out anything still buffered
+   */
+  ~BitOutputStream();
 
   /** Write the least significant bit of the argument into
    *  the bit buffer, and increment the bit buffer index.
-   *  Flush to the ostream first if the bit buffer is full.
    *  This must be consistent with BitInputStream::readBit().
    */
   void writeBit(int bit);
 
-  /** Write the least significant byte of the argument to the ostream.
-   *  This function doesn't touch the bit buffer.
-   *  The client has to manage interaction between writing bits
-   *  and writing bytes.
+  /** Write the n (0 <= n <= 64) least significant bits of the argument
+   *  into the bit buffer, most significant of them first.
+   *  Same as n calls to writeBit.
+   */
+  void writeBits(uint64_t bits, int n);
+
+  /** Write the least significant byte of the argument.
+   *  This goes through the bit buffer, so the client has to manage
+   *  interaction between writing bits and writing bytes: bytes
+   *  written while the bit buffer holds a partial byte are not aligned.
    */
   void writeByte(int b);
 
-  /** Write the argument to the ostream.
-   *  This function doesn't touch the bit buffer.
+  /** Write the argument in native byte order.
    *  The client has to manage interaction between writing bits
-   *  and writing ints.
+   *  and writing ints, as for writeByte.
    */
   void writeLong(long l);
 
-  /** If the bit buffer contains any bits, flush the bit buffer to the ostream,
-   *  clear the bit buffer, and set the bit buffer index to 0.
-   *  Also flush the ostream itself.
+  /** Write the argument as a variable length integer: 7 bits per byte,
+   *  least significant first, with the top bit set on all but the last.
+   *  The client has to manage interaction between writing bits
+   *  and writing ints, as for writeByte.
+   */
+  void writeVarint(uint64_t v);
+
+  /** Write the n bytes at src.
+   *  PRECONDITION: the stream is at a byte boundary.
+   */
+  void writeBytes(const char* src, size_t n);
+
+  /** Pad the bit buffer with 0 bits up to a whole byte, without
+   *  writing anything out.
+   */
+  void padToByte() { this->bufi = (this->bufi + 7) & ~7; }
+
+  /** Pad the bit buffer with 0 bits up to a whole byte, write all
+   *  buffered bytes to the ostream (or vector) and flush the ostream itself.
    */
   void flush();
+
+  /** Return the number of bytes handed to the ostream (or vector)
+   *  so far, not counting bytes still buffered.
+   */
+  size_t bytesWritten() const { return this->written; }
+
+  /** Return the number of bytes written from the start of the stream,
+   *  including the ones still buffered.
+   *  PRECONDITION: the stream is at a byte boundary.
+   */
+  size_t position() const { return this->written + this->blocki + this->bufi / 8; }
+
+  /** Return true if bytes were dropped because the fixed buffer
+   *  written to was too small.
+   */
+  bool overflowed() const { return this->overflow; }
 };
 
+/** Implementation of writeBits
+ */
+inline void BitOutputStream::writeBits(uint64_t bits, int n)
+{
+  //nothing to do for an empty code
+  if (n == 0)
+    return;
+
+  //a value wider than the accumulator can hold on top of a partial
+  //byte is written as its high bits followed by its low 32 bits
+  if (n > 56)
+  {
+    this->writeBits(bits >> 32, n - 32);
+    bits &= 0xffffffffULL;
+    n = 32;
+  }
+
+  //make room by moving the whole bytes out of the accumulator
+  if (this->bufi + n > 64)
+    this->flushBits();
+
+  //put the n bits directly below the bits already in the accumulator
+  this->buf |= (bits << (64 - n)) >> this->bufi;
+  this->bufi += n;
+}
+
+/** Implementation of writeBit
+ */
+inline void BitOutputStream::writeBit(int bit)
+{
+  this->writeBits(bit & 1, 1);
+}
+
 #endif // BITOUTPUTSTREAM_HPP
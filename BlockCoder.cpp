@@ -0,0 +1,421 @@
+#include "BlockCoder.hpp"
+#include "ThreadPool.hpp"
+#include <deque>
+#include <memory>
+#include <future>
+#include <unistd.h>
+#include <fcntl.h>
+
+/** A block on its way through the worker pool
+ */
+struct BlockCoder::Job {
+    std::vector<byte> raw;    // the message bytes of the block, if read into memory
+    const byte* src;          // the message bytes of the block to compress
+    size_t size;              // the number of message bytes at src
+    std::vector<char> body;   // the compressed block
+    off_t offset;             // where the block starts in the message
+    uint32_t crc;             // the CRC32C of the message bytes of the block
+    bool ok;                  // cleared if the block couldn't be written, or is damaged
+    Stats stats;              // the stats of just this block
+    std::future<void> done;   // ready once the worker is done with the block
+
+    Job() : src(0), size(0), offset(0), crc(0), ok(true) { }
+};
+
+/** Set up a coder using blocks of blockSize bytes, the given number
+ *  of worker threads and codes of at most codeLengthLimit bits.
+ */
+BlockCoder::BlockCoder(size_t blockSize, int threads, int codeLengthLimit) :
+    blockSize(std::min(std::max(blockSize, (size_t)1), (size_t)MAX_BLOCK_SIZE)), threads(threads), codeLengthLimit(codeLengthLimit),
+    memoryLimit(0), streams(1), checksums(false), indexed(false), stats(0)
+{
+    //block code lengths have to fit the 4-bit code length header
+    if (this->codeLengthLimit < 1 || this->codeLengthLimit > HCTree::MAX_HEADER_CODE_LENGTH)
+        this->codeLengthLimit = HCTree::MAX_HEADER_CODE_LENGTH;
+}
+
+/** Compress the raw bytes of a block into its body.
+ */
+void BlockCoder::compressJob(Job& job) const
+{
+    //build a code for just this block and write the block with it
+    HCTree codeTree;
+    codeTree.setCodeLengthLimit(this->codeLengthLimit);
+    if (this->stats != nullptr)
+        codeTree.setStats(&job.stats);
+
+    BitOutputStream out(job.body);
+    codeTree.compressBlock(job.src, job.size, out, this->streams);
+    out.flush();
+
+    //checksum the bytes while they are still in the cache
+    if (this->checksums)
+        job.crc = Crc32c::compute(job.src, job.size);
+}
+
+/** Set a cap on the memory used for blocks while compressing, 0 for
+ *  no cap. Every block in flight needs about twice the block size, for
+ *  its bytes and its body, so the cap limits the number of blocks in
+ *  flight, and shrinks the block size if even one block would not fit.
+ */
+void BlockCoder::setMemoryLimit(size_t bytes)
+{
+    this->memoryLimit = bytes;
+    if (bytes > 0 && 2 * this->blockSize > bytes)
+        this->blockSize = std::max(bytes / 2, (size_t)1);
+}
+
+/** Code every block as HCTree::BLOCK_STREAMS streams that can be
+ *  decoded side by side (FORMAT_STREAMS) if split is set, or as a
+ *  single stream (FORMAT_BLOCKED) otherwise.
+ */
+void BlockCoder::setSplitStreams(bool split)
+{
+    this->streams = split ? HCTree::BLOCK_STREAMS : 1;
+}
+
+/** Give every block a CRC32C of its bytes (HCTree::FORMAT_CHECKSUM)
+ *  if on is set.
+ */
+void BlockCoder::setChecksums(bool on)
+{
+    this->checksums = on;
+}
+
+/** End the file with an index of its blocks (HCTree::FORMAT_INDEX)
+ *  if on is set.
+ */
+void BlockCoder::setIndex(bool on)
+{
+    this->indexed = on;
+}
+
+/** Add the time spent on every block, and the counts and code lengths
+ *  of its bytes, to stats, along with the time spent reading and
+ *  writing blocks.
+ */
+void BlockCoder::setStats(Stats* stats)
+{
+    this->stats = stats;
+}
+
+/** Write the header of a blocked file: the magic number, the format
+ *  version for the given number of streams with the given flags
+ *  added, and the block size.
+ */
+void BlockCoder::writeHeader(BitOutputStream& out, size_t blockSize, int streams, int flags)
+{
+    int format = streams > 1 ? HCTree::FORMAT_STREAMS : HCTree::FORMAT_BLOCKED;
+    HCTree::writeFormat(out, format | flags);
+    out.writeVarint(blockSize);
+}
+
+/** Write a block of rawSize message bytes compressed into body:
+ *  its sizes, the CRC32C crc of its bytes if checksum is set, then
+ *  the body itself.
+ */
+void BlockCoder::writeBlock(BitOutputStream& out, size_t rawSize, const std::vector<char>& body,
+                            bool checksum, uint32_t crc)
+{
+    out.writeVarint(rawSize);
+    out.writeVarint(body.size());
+    if (checksum)
+    {
+        for (int k = 0; k < 4; k++)
+            out.writeByte(crc >> (8 * k));
+    }
+    out.writeBytes(body.data(), body.size());
+}
+
+/** Write the index of the blocks at the end of the file: the entries,
+ *  with one for the end of the blocks last, then the trailer.
+ *  base is the offset in the file of the first byte out wrote.
+ */
+void BlockCoder::writeIndex(BitOutputStream& out, const std::vector<IndexEntry>& index, uint64_t base)
+{
+    uint64_t start = base + out.position();
+
+    //every number takes 8 bytes, so entries can be found without reading
+    //the ones before them
+    for (size_t i = 0; i < index.size(); i++)
+    {
+        for (int k = 0; k < 8; k++)
+            out.writeByte(index[i].codedOffset >> (8 * k));
+        for (int k = 0; k < 8; k++)
+            out.writeByte(index[i].messageOffset >> (8 * k));
+    }
+
+    //the trailer tells where the index starts
+    for (int k = 0; k < 8; k++)
+        out.writeByte(start >> (8 * k));
+    for (int k = 0; k < 4; k++)
+        out.writeByte(INDEX_MAGIC >> (8 * k));
+}
+
+/** Compress everything in rStream into a blocked file in wStream.
+ *  The input is read only once, a block at a time, so it can be a pipe.
+ */
+void BlockCoder::compress(std::ostream& wStream, std::istream& rStream)
+{
+    this->compressBlocks(wStream, [this, &rStream](Job& job)
+    {
+        //read the next block of the input
+        job.raw.resize(this->blockSize);
+        rStream.read(reinterpret_cast<char*>(&job.raw[0]), this->blockSize);
+        job.raw.resize(rStream.gcount());
+
+        job.src = job.raw.data();
+        job.size = job.raw.size();
+        return job.size > 0;
+    });
+}
+
+/** Compress the n bytes at src into a blocked file in wStream.
+ *  The blocks are compressed in place, without copying them.
+ */
+void BlockCoder::compress(std::ostream& wStream, const byte* src, size_t n)
+{
+    size_t pos = 0;
+    this->compressBlocks(wStream, [this, src, n, &pos](Job& job)
+    {
+        //the next block starts where the last one ended
+        job.src = src + pos;
+        job.size = std::min(this->blockSize, n - pos);
+        pos += job.size;
+        return job.size > 0;
+    });
+}
+
+/** Write a blocked file to wStream with the blocks next hands out,
+ *  until it returns false, compressing them on the worker threads.
+ */
+void BlockCoder::compressBlocks(std::ostream& wStream, const std::function<bool(Job&)>& next)
+{
+    //create an output stream object and write the file header
+    BitOutputStream out(wStream);
+    writeHeader(out, this->blockSize, this->streams,
+                (this->checksums ? HCTree::FORMAT_CHECKSUM : 0) | (this->indexed ? HCTree::FORMAT_INDEX : 0));
+
+    //where every block starts, for the index
+    std::vector<IndexEntry> index;
+    uint64_t messageOffset = 0;
+
+    //blocks that have been handed to the pool, oldest first,
+    //up to two per thread or as many as the memory cap allows
+    ThreadPool pool(this->threads);
+    std::deque<std::shared_ptr<Job> > pending;
+    size_t maxPending = 2 * pool.size();
+    if (this->memoryLimit > 0)
+        maxPending = std::max((size_t)1, std::min(maxPending, this->memoryLimit / (2 * this->blockSize)));
+
+    bool atEnd = false;
+    while (true)
+    {
+        //write out the oldest blocks while the pool is full, or all of
+        //them at the end of the input, always in input order
+        while (!pending.empty() && (atEnd || pending.size() >= maxPending))
+        {
+            Job& oldest = *pending.front();
+            oldest.done.get();
+
+            double start = this->stats ? Stats::now() : 0;
+            if (this->indexed)
+            {
+                IndexEntry entry = { out.position(), messageOffset };
+                index.push_back(entry);
+                messageOffset += oldest.size;
+            }
+            writeBlock(out, oldest.size, oldest.body, this->checksums, oldest.crc);
+
+            //the stats of the blocks are added up in input order
+            if (this->stats != nullptr)
+            {
+                oldest.stats.seconds[Stats::IO] += Stats::now() - start;
+                this->stats->add(oldest.stats);
+            }
+
+            pending.pop_front();
+        }
+
+        if (atEnd)
+            break;
+
+        //get the next block, and if there is one, hand it to the pool
+        std::shared_ptr<Job> job = std::make_shared<Job>();
+        double start = this->stats ? Stats::now() : 0;
+        atEnd = !next(*job);
+        if (this->stats != nullptr)
+            this->stats->seconds[Stats::IO] += Stats::now() - start;
+        if (!atEnd)
+        {
+            job->done = pool.submit([this, job]() { this->compressJob(*job); });
+            pending.push_back(job);
+        }
+    }
+
+    //end the file with an empty block, and the index if it has one
+    double start = this->stats ? Stats::now() : 0;
+    if (this->indexed)
+    {
+        IndexEntry entry = { out.position(), messageOffset };
+        index.push_back(entry);
+    }
+    out.writeVarint(0);
+    if (this->indexed)
+        writeIndex(out, index);
+    out.flush();
+    if (this->stats != nullptr)
+    {
+        this->stats->seconds[Stats::IO] += Stats::now() - start;
+        this->stats->codedBytes += out.bytesWritten();
+    }
+}
+
+/** Decompress the body of a block and write the bytes at the
+ *  block's offset in the file open at fd.
+ */
+void BlockCoder::decompressJob(Job& job, int fd) const
+{
+    //decode the block with the code in its code lengths
+    HCTree codeTree;
+    if (this->stats != nullptr)
+        codeTree.setStats(&job.stats);
+    BitInputStream in(job.body.data(), job.body.size());
+    codeTree.decompressBlock(in, &job.raw[0], job.raw.size(), this->streams);
+
+    //check the bytes against the checksum while they are still in the cache
+    if (this->checksums && Crc32c::compute(&job.raw[0], job.raw.size()) != job.crc)
+    {
+        job.ok = false;
+        return;
+    }
+
+    //without a file the block is only checked, or written later
+    if (fd < 0)
+        return;
+
+    //write the bytes where they belong in the output file
+    double start = this->stats ? Stats::now() : 0;
+    job.ok = writeAll(fd, &job.raw[0], job.raw.size(), job.offset);
+    if (this->stats != nullptr)
+        job.stats.seconds[Stats::IO] += Stats::now() - start;
+}
+
+/** Write the n bytes at src to the file open at fd, at offset in
+ *  the file, or at the current position if offset is below 0.
+ *  Return false if they can't all be written.
+ */
+bool BlockCoder::writeAll(int fd, const byte* src, size_t n, off_t offset)
+{
+    size_t written = 0;
+    while (written < n)
+    {
+        ssize_t k = offset < 0 ? write(fd, src + written, n - written)
+                               : pwrite(fd, src + written, n - written, offset + written);
+        if (k <= 0)
+            return false;
+        written += k;
+    }
+    return true;
+}
+
+/** Decompress the blocks of a blocked file into the file open for
+ *  writing at fd, decoding blocks on the worker threads.
+ *  Return false if the file is truncated or damaged, or can't be written.
+ */
+bool BlockCoder::decompress(int fd, BitInputStream& in)
+{
+    //read the block size, no block may be larger
+    long maxBlock = in.readVarint();
+    if (maxBlock < 1 || maxBlock > MAX_BLOCK_SIZE)
+        return false;
+
+    //blocks that have been handed to the pool, oldest first
+    ThreadPool pool(this->threads);
+    std::deque<std::shared_ptr<Job> > pending;
+    size_t maxPending = 2 * pool.size();
+
+    //the offset of the next block in the output file, after whatever
+    //is in front of its current position; a file that can't seek, or
+    //appends whatever the offset, is written in order here instead of
+    //by the workers
+    off_t offset = fd < 0 ? 0 : lseek(fd, 0, SEEK_CUR);
+    bool inOrder = fd >= 0 && (offset < 0 || (fcntl(fd, F_GETFL) & O_APPEND) != 0);
+    int jobFd = inOrder ? -1 : fd;
+    offset = std::max(offset, (off_t)0);
+    bool ok = true;
+
+    while (ok)
+    {
+        //read the size of the next block, 0 ends the file
+        long rawSize = in.readVarint();
+        if (rawSize == 0)
+            break;
+        long bodySize = in.readVarint();
+        if (rawSize < 0 || rawSize > maxBlock || bodySize < 0 || bodySize > rawSize + MAX_BODY_OVERHEAD)
+        {
+            ok = false;
+            break;
+        }
+
+        //read the checksum of the block, then the compressed block
+        std::shared_ptr<Job> job = std::make_shared<Job>();
+        double start = this->stats ? Stats::now() : 0;
+        if (this->checksums)
+        {
+            byte crc[4];
+            if (in.readBytes(reinterpret_cast<char*>(crc), 4) != 4)
+            {
+                ok = false;
+                break;
+            }
+            job->crc = crc[0] | (crc[1] << 8) | (crc[2] << 16) | ((uint32_t)crc[3] << 24);
+        }
+        job->body.resize(bodySize);
+        if (in.readBytes(job->body.data(), bodySize) != (size_t)bodySize)
+        {
+            ok = false;
+            break;
+        }
+        if (this->stats != nullptr)
+            job->stats.seconds[Stats::IO] += Stats::now() - start;
+
+        //the block goes right after the blocks before it
+        job->raw.resize(rawSize);
+        job->offset = offset;
+        offset += rawSize;
+
+        //hand it to the pool
+        job->done = pool.submit([this, job, jobFd]() { this->decompressJob(*job, jobFd); });
+        pending.push_back(job);
+
+        //once the pool is full, wait for the oldest block
+        if (pending.size() >= maxPending)
+        {
+            Job& oldest = *pending.front();
+            oldest.done.get();
+            ok = oldest.ok && (!inOrder || writeAll(fd, &oldest.raw[0], oldest.raw.size(), -1));
+            if (this->stats != nullptr)
+                this->stats->add(pending.front()->stats);
+            pending.pop_front();
+        }
+    }
+
+    //wait for the rest of the blocks
+    while (!pending.empty())
+    {
+        Job& oldest = *pending.front();
+        oldest.done.get();
+        ok = ok && oldest.ok && (!inOrder || writeAll(fd, &oldest.raw[0], oldest.raw.size(), -1));
+        if (this->stats != nullptr)
+            this->stats->add(pending.front()->stats);
+        pending.pop_front();
+    }
+
+    //leave the file position after the blocks, like in order writes do,
+    //so whatever is written to fd next goes after them
+    if (fd >= 0 && !inOrder)
+        ok = lseek(fd, offset, SEEK_SET) >= 0 && ok;
+
+    return ok;
+}
@@ -0,0 +1,194 @@
+#ifndef BLOCKCODER_HPP
+#define BLOCKCODER_HPP
+
+#include <iostream>
+#include <vector>
+#include <functional>
+#include "HCTree.hpp"
+#include "BitInputStream.hpp"
+#include "BitOutputStream.hpp"
+#include "Crc32c.hpp"
+
+/** A class for the blocked container formats (FORMAT_BLOCKED, and
+ *  FORMAT_STREAMS where every block is coded as BLOCK_STREAMS streams).
+ *  The message is cut into blocks of a fixed size, and every block is
+ *  compressed on its own with a code built for just that block, so
+ *  blocks can be compressed on several threads at once.
+ *
+ *  File layout, after the magic number and format version:
+ *    block size (varint)
+ *    for every block: raw size (varint), body size (varint),
+ *      CRC32C of the raw bytes (4 bytes, least significant first) if
+ *      the version has HCTree::FORMAT_CHECKSUM set, body
+ *    raw size 0 to end the file
+ *    if the version has HCTree::FORMAT_INDEX set, the index:
+ *      for every block, and once more for the end of the blocks: the
+ *        offset of the block in the file and in the message (8 bytes
+ *        each, least significant first)
+ *      the offset of the index in the file (8 bytes), INDEX_MAGIC (4 bytes)
+ *  A body is written by HCTree::compressBlock and padded to a whole byte.
+ *  Checksums are computed by the worker threads, right after a block
+ *  is coded or decoded, while its bytes are still in the cache.
+ *  The index is read by BlockReader, which decodes ranges of the message
+ *  from just the blocks that cover them.
+ *  Blocks don't depend on the thread count, so neither does the output.
+ *  The block sizes in front of the bodies are the index that tells
+ *  where every block goes in the uncompressed file, so blocks can be
+ *  decompressed on several threads at once as well.
+ */
+class BlockCoder {
+private:
+    size_t blockSize;     // number of message bytes per block
+    int threads;          // number of worker threads
+    int codeLengthLimit;  // longest code of a block
+    size_t memoryLimit;   // cap on the memory for blocks in flight, 0 for none
+    int streams;          // number of streams every block is coded as
+    bool checksums;       // set if every block carries a CRC32C
+    bool indexed;         // set if the file ends with an index of its blocks
+    Stats* stats;         // where the stats of all blocks are added up, if anywhere
+
+    /** A block on its way through the worker pool
+     */
+    struct Job;
+
+    /** Compress the raw bytes of a block into its body.
+     */
+    void compressJob(Job& job) const;
+
+    /** Write a blocked file to wStream with the blocks next hands out,
+     *  until it returns false, compressing them on the worker threads.
+     */
+    void compressBlocks(std::ostream& wStream, const std::function<bool(Job&)>& next);
+
+    /** Decompress the body of a block and write the bytes at the
+     *  block's offset in the file open at fd, unless fd is below 0.
+     */
+    void decompressJob(Job& job, int fd) const;
+
+    /** Write the n bytes at src to the file open at fd, at offset in
+     *  the file, or at the current position if offset is below 0.
+     *  Return false if they can't all be written.
+     */
+    static bool writeAll(int fd, const byte* src, size_t n, off_t offset);
+
+public:
+    /** Default number of message bytes per block
+     */
+    static const size_t DEFAULT_BLOCK_SIZE = 1024 * 1024;
+
+    /** Largest block size a file may have. Larger block sizes are cut
+     *  down to it, and a file claiming a larger one is damaged.
+     */
+    static const long MAX_BLOCK_SIZE = 1L << 30;
+
+    /** Most bytes a block body can take on top of its message bytes:
+     *  the code lengths, the jump table and padding, as codes never
+     *  average more than 8 bits
+     */
+    static const long MAX_BODY_OVERHEAD = 256;
+
+    /** The last 4 bytes of a file with an index ("HCIX")
+     */
+    static const uint32_t INDEX_MAGIC = 0x48434958;
+
+    /** Bytes after the index entries: the index offset and INDEX_MAGIC
+     */
+    static const size_t INDEX_TRAILER = 12;
+
+    /** An entry of the index: where a block starts
+     */
+    struct IndexEntry {
+        uint64_t codedOffset;    // offset of the block's sizes in the file
+        uint64_t messageOffset;  // offset of the block's bytes in the message
+    };
+
+    /** Set up a coder using blocks of blockSize bytes (at most
+     *  MAX_BLOCK_SIZE), the given number of worker threads (below 1 for
+     *  one per hardware thread) and codes of at most codeLengthLimit
+     *  bits (0 for the format's maximum).
+     */
+    BlockCoder(size_t blockSize = DEFAULT_BLOCK_SIZE, int threads = 1,
+               int codeLengthLimit = HCTree::MAX_HEADER_CODE_LENGTH);
+
+    /** Set a cap on the memory used for blocks while compressing, 0 for
+     *  no cap. Every block in flight needs about twice the block size, for
+     *  its bytes and its body, so the cap limits the number of blocks in
+     *  flight, and shrinks the block size if even one block would not fit.
+     */
+    void setMemoryLimit(size_t bytes);
+
+    /** Code every block as HCTree::BLOCK_STREAMS streams that can be
+     *  decoded side by side (FORMAT_STREAMS) if split is set, or as a
+     *  single stream (FORMAT_BLOCKED) otherwise.
+     */
+    void setSplitStreams(bool split);
+
+    /** Give every block a CRC32C of its bytes (HCTree::FORMAT_CHECKSUM)
+     *  if on is set. Decompressing, this has to match the flag in the
+     *  format version, and the blocks are checked against their CRCs.
+     */
+    void setChecksums(bool on);
+
+    /** End the file with an index of its blocks (HCTree::FORMAT_INDEX)
+     *  if on is set.
+     */
+    void setIndex(bool on);
+
+    /** Add the time spent on every block, and the counts and code lengths
+     *  of its bytes, to stats, along with the time spent reading and
+     *  writing blocks. Null (the default) keeps no stats.
+     */
+    void setStats(Stats* stats);
+
+    /** Write the header of a blocked file: the magic number, the format
+     *  version for the given number of streams with the given flags
+     *  (HCTree::FORMAT_CHECKSUM and HCTree::FORMAT_INDEX) added, and the
+     *  block size.
+     */
+    static void writeHeader(BitOutputStream& out, size_t blockSize, int streams, int flags = 0);
+
+    /** Write a block of rawSize message bytes compressed into body:
+     *  its sizes, the CRC32C crc of its bytes if checksum is set, then
+     *  the body itself.
+     */
+    static void writeBlock(BitOutputStream& out, size_t rawSize, const std::vector<char>& body,
+                           bool checksum = false, uint32_t crc = 0);
+
+    /** Write the index of the blocks at the end of the file: the entries,
+     *  with one for the end of the blocks last, then the trailer.
+     *  base is the offset in the file of the first byte out wrote.
+     */
+    static void writeIndex(BitOutputStream& out, const std::vector<IndexEntry>& index, uint64_t base = 0);
+
+    /** Compress everything in rStream into a blocked file in wStream.
+     *  The input is read only once, a block at a time, so it can be a
+     *  pipe. Up to two blocks per thread are in memory at a time, fewer
+     *  under a memory cap.
+     */
+    void compress(std::ostream& wStream, std::istream& rStream);
+
+    /** Compress the n bytes at src into a blocked file in wStream.
+     *  The blocks are compressed in place, without copying them.
+     */
+    void compress(std::ostream& wStream, const byte* src, size_t n);
+
+    /** Decompress the blocks of a blocked file into the file open for
+     *  writing at fd. Blocks are decoded on the worker threads, and each
+     *  thread writes its block straight to its final offset, counted
+     *  from the current position of fd, with pwrite, and the position is
+     *  left after the last block. If fd can't seek, like a pipe, or
+     *  appends, the blocks are written in order as they finish.
+     *  With fd below 0 the blocks are only decoded and checked.
+     *  Up to two blocks per thread are in memory at a time.
+     *  PRECONDITION: HCTree::readFormat has read the format version
+     *  from in and returned FORMAT_BLOCKED, or FORMAT_STREAMS and
+     *  setSplitStreams(true) has been called, and setChecksums has been
+     *  called if it has FORMAT_CHECKSUM set.
+     *  Return false if the file is truncated or damaged (including sizes
+     *  too large for the block size), a block doesn't match its
+     *  checksum, or the file can't be written.
+     */
+    bool decompress(int fd, BitInputStream& in);
+};
+
+#endif // BLOCKCODER_HPP
@@ -0,0 +1,198 @@
+#include "BlockReader.hpp"
+#include "BitInputStream.hpp"
+#include "Crc32c.hpp"
+#include <algorithm>
+
+/** Return the n byte number at src, least significant byte first
+ */
+static uint64_t readLittleEndian(const byte* src, int n)
+{
+    uint64_t v = 0;
+    for (int k = n - 1; k >= 0; k--)
+        v = (v << 8) | src[k];
+    return v;
+}
+
+/** Find the blocks of the blocked file in the n bytes at data.
+ *  POSTCONDITION: isValid() tells if it is a blocked file whose
+ *  blocks were found.
+ */
+BlockReader::BlockReader(const byte* data, size_t n) :
+    data(data), size(n), streams(1), checksums(false), indexed(false), maxBlock(0), valid(false)
+{
+    //the magic number and format version, then the block size
+    if (n < 4 || ((data[0] << 16) | (data[1] << 8) | data[2]) != HCTree::FORMAT_MAGIC)
+        return;
+    int format = data[3] & ~(HCTree::FORMAT_CHECKSUM | HCTree::FORMAT_INDEX);
+    if (format != HCTree::FORMAT_BLOCKED && format != HCTree::FORMAT_STREAMS)
+        return;
+    size_t first = 4;
+    if (!this->readVarint(first, this->maxBlock) || this->maxBlock < 1 || this->maxBlock > BlockCoder::MAX_BLOCK_SIZE)
+        return;
+
+    this->streams = (format == HCTree::FORMAT_STREAMS) ? HCTree::BLOCK_STREAMS : 1;
+    this->checksums = (data[3] & HCTree::FORMAT_CHECKSUM) != 0;
+
+    //use the index if there is one, or else step over the blocks
+    this->indexed = (data[3] & HCTree::FORMAT_INDEX) != 0 && this->readIndex(first);
+    this->valid = this->indexed || this->scanBlocks(first);
+}
+
+/** Read a varint at data[pos] into v and move pos past it.
+ *  Return false if the file ends first.
+ */
+bool BlockReader::readVarint(size_t& pos, long& v) const
+{
+    v = 0;
+
+    //add 7 bits at a time until a byte without the top bit
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (pos >= this->size)
+            return false;
+        int c = this->data[pos++];
+        v |= (long)(c & 127) << shift;
+        if (c < 128)
+            return true;
+    }
+
+    return false;
+}
+
+/** Read the index at the end of the file into blocks.
+ *  Return false if it is missing or damaged.
+ */
+bool BlockReader::readIndex(size_t first)
+{
+    //the trailer tells where the index starts
+    if (this->size < first + BlockCoder::INDEX_TRAILER)
+        return false;
+    const byte* trailer = this->data + this->size - BlockCoder::INDEX_TRAILER;
+    uint64_t start = readLittleEndian(trailer, 8);
+    if (readLittleEndian(trailer + 8, 4) != BlockCoder::INDEX_MAGIC ||
+        start < first || start > this->size - BlockCoder::INDEX_TRAILER ||
+        (this->size - BlockCoder::INDEX_TRAILER - start) % 16 != 0)
+        return false;
+
+    //read the entries, which have to start at the first block and move
+    //forward by at most a block at a time
+    size_t count = (this->size - BlockCoder::INDEX_TRAILER - start) / 16;
+    if (count == 0)
+        return false;
+    this->blocks.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const byte* entry = this->data + start + 16 * i;
+        this->blocks[i].codedOffset = readLittleEndian(entry, 8);
+        this->blocks[i].messageOffset = readLittleEndian(entry + 8, 8);
+
+        bool ok = (i == 0) ? (this->blocks[i].codedOffset == first && this->blocks[i].messageOffset == 0)
+                           : (this->blocks[i].codedOffset > this->blocks[i - 1].codedOffset &&
+                              this->blocks[i].messageOffset > this->blocks[i - 1].messageOffset &&
+                              this->blocks[i].messageOffset - this->blocks[i - 1].messageOffset <=
+                                  (uint64_t)this->maxBlock);
+        if (!ok || this->blocks[i].codedOffset >= start)
+        {
+            this->blocks.clear();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/** Find the blocks by stepping over them from the first one, at
+ *  offset first in the file.
+ *  Return false if the file is truncated or damaged.
+ */
+bool BlockReader::scanBlocks(size_t first)
+{
+    size_t pos = first;
+    uint64_t messageOffset = 0;
+    size_t crcSize = this->checksums ? 4 : 0;
+
+    while (true)
+    {
+        //read the sizes of the next block, 0 ends the file
+        BlockCoder::IndexEntry entry = { pos, messageOffset };
+        this->blocks.push_back(entry);
+        long rawSize, bodySize;
+        if (!this->readVarint(pos, rawSize))
+            break;
+        if (rawSize == 0)
+            return true;
+        if (!this->readVarint(pos, bodySize) || rawSize < 0 || rawSize > this->maxBlock || bodySize < 0 ||
+            this->size - pos < crcSize + bodySize)
+            break;
+
+        //skip the checksum and the body
+        pos += crcSize + bodySize;
+        messageOffset += rawSize;
+    }
+
+    this->blocks.clear();
+    return false;
+}
+
+/** Decompress the bytes of the message from offset from up to offset
+ *  to into dst, decoding only the blocks that cover them.
+ *  Return false if a block turns out to be damaged, or doesn't match
+ *  its checksum.
+ */
+bool BlockReader::read(uint64_t from, uint64_t to, byte* dst) const
+{
+    //find the last block that starts at or before from
+    BlockCoder::IndexEntry key = { 0, from };
+    size_t i = std::upper_bound(this->blocks.begin(), this->blocks.end() - 1, key,
+                                [](const BlockCoder::IndexEntry& a, const BlockCoder::IndexEntry& b) {
+                                    return a.messageOffset < b.messageOffset;
+                                }) - this->blocks.begin() - 1;
+
+    std::vector<byte> scratch;
+    for (; from < to; i++)
+    {
+        //the block has to agree with the index about its size
+        size_t pos = this->blocks[i].codedOffset;
+        uint64_t blockStart = this->blocks[i].messageOffset;
+        long rawSize, bodySize;
+        if (!this->readVarint(pos, rawSize) || !this->readVarint(pos, bodySize) ||
+            (uint64_t)rawSize != this->blocks[i + 1].messageOffset - blockStart || bodySize < 0 ||
+            this->size - pos < (this->checksums ? 4 : 0) + (size_t)bodySize)
+            return false;
+        uint32_t crc = 0;
+        if (this->checksums)
+        {
+            crc = readLittleEndian(this->data + pos, 4);
+            pos += 4;
+        }
+
+        //the part of the block that is asked for
+        size_t lo = from - blockStart;
+        size_t hi = std::min(to - blockStart, (uint64_t)rawSize);
+
+        //a whole block is decoded straight into dst, and the front of a
+        //single stream block can be decoded without the rest
+        HCTree codeTree;
+        BitInputStream in(reinterpret_cast<const char*>(this->data + pos), bodySize);
+        bool whole = (lo == 0 && hi == (size_t)rawSize);
+        size_t decoded = (whole || this->streams > 1) ? rawSize : hi;
+        byte* out = dst;
+        if (!whole)
+        {
+            scratch.resize(decoded);
+            out = &scratch[0];
+        }
+        codeTree.decompressBlock(in, out, decoded, this->streams);
+
+        //only a block decoded in full can be checked
+        if (this->checksums && decoded == (size_t)rawSize && Crc32c::compute(out, rawSize) != crc)
+            return false;
+
+        if (!whole)
+            std::copy(out + lo, out + hi, dst);
+        dst += hi - lo;
+        from = blockStart + hi;
+    }
+
+    return true;
+}
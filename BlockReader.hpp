@@ -0,0 +1,82 @@
+#ifndef BLOCKREADER_HPP
+#define BLOCKREADER_HPP
+
+#include <vector>
+#include <cstdint>
+#include "HCTree.hpp"
+#include "BlockCoder.hpp"
+
+/** A class for reading ranges of the message of a blocked file that is
+ *  in memory, like a mapped file, without decompressing all of it.
+ *  The blocks are found from the index at the end of the file if it has
+ *  one (HCTree::FORMAT_INDEX), and otherwise by stepping over the block
+ *  sizes once, which doesn't decode anything. A range then only costs
+ *  the blocks that cover it, so smaller blocks make reads of small
+ *  ranges faster, at some cost in compression.
+ */
+class BlockReader {
+private:
+    const byte* data;      // the bytes of the compressed file
+    size_t size;           // the number of bytes in the file
+    int streams;           // number of streams every block is coded as
+    bool checksums;        // set if every block carries a CRC32C
+    bool indexed;          // set if the file ends with an index of its blocks
+    long maxBlock;         // block size of the file, no block may be larger
+    bool valid;            // set if the blocks were found
+
+    /** Where every block starts, with one more entry for the end of the blocks
+     */
+    std::vector<BlockCoder::IndexEntry> blocks;
+
+    /** Read the index at the end of the file into blocks.
+     *  Return false if it is missing or damaged.
+     */
+    bool readIndex(size_t first);
+
+    /** Find the blocks by stepping over them from the first one, at
+     *  offset first in the file.
+     *  Return false if the file is truncated or damaged.
+     */
+    bool scanBlocks(size_t first);
+
+    /** Read a varint at data[pos] into v and move pos past it.
+     *  Return false if the file ends first.
+     */
+    bool readVarint(size_t& pos, long& v) const;
+
+public:
+    /** Find the blocks of the blocked file in the n bytes at data, which
+     *  have to stay valid while the reader is used.
+     *  POSTCONDITION: isValid() tells if it is a blocked file whose
+     *  blocks were found.
+     */
+    BlockReader(const byte* data, size_t n);
+
+    /** Check if the file is a blocked file whose blocks were found
+     */
+    bool isValid() const { return this->valid; }
+
+    /** Check if the blocks were found from the index at the end of the file
+     */
+    bool hasIndex() const { return this->indexed; }
+
+    /** Return the number of blocks in the file
+     */
+    size_t blockCount() const { return this->valid ? this->blocks.size() - 1 : 0; }
+
+    /** Return the number of bytes in the message
+     *  PRECONDITION: isValid()
+     */
+    uint64_t messageSize() const { return this->blocks.back().messageOffset; }
+
+    /** Decompress the bytes of the message from offset from up to offset
+     *  to into dst, decoding only the blocks that cover them.
+     *  Return false if a block turns out to be damaged, or doesn't match
+     *  its checksum.
+     *  PRECONDITION: isValid() and from <= to <= messageSize(), and dst
+     *  has room for to - from bytes.
+     */
+    bool read(uint64_t from, uint64_t to, byte* dst) const;
+};
+
+#endif // BLOCKREADER_HPP
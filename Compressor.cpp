@@ -0,0 +1,138 @@
+#include "Compressor.hpp"
+#include "BitOutputStream.hpp"
+
+/** Set up a compressor using blocks of blockSize bytes and codes of
+ *  at most codeLengthLimit bits, coding every block as
+ *  HCTree::BLOCK_STREAMS streams if split is set.
+ */
+Compressor::Compressor(size_t blockSize, int codeLengthLimit, bool split) :
+    blockSize(std::min(std::max(blockSize, (size_t)1), (size_t)BlockCoder::MAX_BLOCK_SIZE)), codeLengthLimit(codeLengthLimit),
+    streams(split ? HCTree::BLOCK_STREAMS : 1), checksums(false), indexed(false),
+    codedOffset(0), messageOffset(0), started(false), finished(false)
+{
+    //block code lengths have to fit the 4-bit code length header
+    if (this->codeLengthLimit < 1 || this->codeLengthLimit > HCTree::MAX_HEADER_CODE_LENGTH)
+        this->codeLengthLimit = HCTree::MAX_HEADER_CODE_LENGTH;
+}
+
+/** Compress the n bytes at src as the next block, adding it to output.
+ */
+void Compressor::writeBlock(const byte* src, size_t n)
+{
+    //build a code for just this block and write the block with it
+    std::vector<char> body;
+    {
+        HCTree codeTree;
+        codeTree.setCodeLengthLimit(this->codeLengthLimit);
+        BitOutputStream bodyOut(body);
+        codeTree.compressBlock(src, n, bodyOut, this->streams);
+        bodyOut.flush();
+    }
+
+    //the block starts after everything handed out or made ready so far
+    if (this->indexed)
+    {
+        BlockCoder::IndexEntry entry = { this->codedOffset + this->output.size(), this->messageOffset };
+        this->index.push_back(entry);
+    }
+    this->messageOffset += n;
+
+    BitOutputStream out(this->output);
+    BlockCoder::writeBlock(out, n, body, this->checksums, this->checksums ? Crc32c::compute(src, n) : 0);
+    out.flush();
+}
+
+/** Give every block a CRC32C of its bytes if on is set.
+ */
+void Compressor::setChecksums(bool on)
+{
+    this->checksums = on;
+}
+
+/** End the file with an index of its blocks if on is set.
+ */
+void Compressor::setIndex(bool on)
+{
+    this->indexed = on;
+}
+
+/** Take the next n bytes of the message at src.
+ *  Return the compressed bytes this made ready, which stay valid
+ *  until the next call.
+ */
+const std::vector<char>& Compressor::update(const byte* src, size_t n)
+{
+    this->codedOffset += this->output.size();
+    this->output.clear();
+
+    //the file header goes in front of the first block
+    if (!this->started)
+    {
+        BitOutputStream out(this->output);
+        BlockCoder::writeHeader(out, this->blockSize, this->streams,
+                                (this->checksums ? HCTree::FORMAT_CHECKSUM : 0) |
+                                (this->indexed ? HCTree::FORMAT_INDEX : 0));
+        out.flush();
+        this->started = true;
+    }
+
+    while (n > 0)
+    {
+        //whole blocks of the input are compressed in place
+        if (this->block.empty() && n >= this->blockSize)
+        {
+            this->writeBlock(src, this->blockSize);
+            src += this->blockSize;
+            n -= this->blockSize;
+            continue;
+        }
+
+        //anything else is held back until it fills a block
+        size_t take = std::min(n, this->blockSize - this->block.size());
+        this->block.insert(this->block.end(), src, src + take);
+        src += take;
+        n -= take;
+
+        if (this->block.size() == this->blockSize)
+        {
+            this->writeBlock(&this->block[0], this->block.size());
+            this->block.clear();
+        }
+    }
+
+    return this->output;
+}
+
+/** End the message: compress the bytes held back and end the file.
+ *  Return the rest of the compressed bytes.
+ */
+const std::vector<char>& Compressor::finish()
+{
+    //an empty message still gets the file header
+    this->update(0, 0);
+    if (this->finished)
+        return this->output;
+
+    //the bytes held back make the last block
+    if (!this->block.empty())
+    {
+        this->writeBlock(&this->block[0], this->block.size());
+        this->block.clear();
+    }
+
+    //end the file with an empty block, and the index if it has one
+    if (this->indexed)
+    {
+        BlockCoder::IndexEntry entry = { this->codedOffset + this->output.size(), this->messageOffset };
+        this->index.push_back(entry);
+    }
+    uint64_t base = this->codedOffset + this->output.size();
+    BitOutputStream out(this->output);
+    out.writeVarint(0);
+    if (this->indexed)
+        BlockCoder::writeIndex(out, this->index, base);
+    out.flush();
+    this->finished = true;
+
+    return this->output;
+}
@@ -0,0 +1,68 @@
+#ifndef COMPRESSOR_HPP
+#define COMPRESSOR_HPP
+
+#include <vector>
+#include "HCTree.hpp"
+#include "BlockCoder.hpp"
+
+/** A class for compressing a message that arrives a piece at a time,
+ *  like the payload of a socket, into a blocked file.
+ *  A code needs the counts of all the bytes it codes, so bytes are
+ *  held back until they fill a block, and every full block is
+ *  compressed and handed out right away. At most one block of the
+ *  message is held at a time. The output is the same as BlockCoder
+ *  writes for the same block size, so uncompress can read it.
+ */
+class Compressor {
+private:
+    size_t blockSize;          // number of message bytes per block
+    int codeLengthLimit;       // longest code of a block
+    int streams;               // number of streams every block is coded as
+    bool checksums;            // set if every block carries a CRC32C
+    bool indexed;              // set if the file ends with an index of its blocks
+    std::vector<BlockCoder::IndexEntry> index;  // where every block starts, for the index
+    uint64_t codedOffset;      // bytes handed out before output
+    uint64_t messageOffset;    // message bytes compressed so far
+    std::vector<byte> block;   // message bytes held back for the next block
+    std::vector<char> output;  // compressed bytes made ready by the last call
+    bool started;              // set once the file header is written
+    bool finished;             // set once the file is ended
+
+    /** Compress the n bytes at src as the next block, adding it to output.
+     */
+    void writeBlock(const byte* src, size_t n);
+
+public:
+    /** Set up a compressor using blocks of blockSize bytes and codes of
+     *  at most codeLengthLimit bits, coding every block as
+     *  HCTree::BLOCK_STREAMS streams if split is set.
+     */
+    Compressor(size_t blockSize = BlockCoder::DEFAULT_BLOCK_SIZE,
+               int codeLengthLimit = HCTree::MAX_HEADER_CODE_LENGTH, bool split = false);
+
+    /** Give every block a CRC32C of its bytes if on is set.
+     *  PRECONDITION: update hasn't been called.
+     */
+    void setChecksums(bool on);
+
+    /** End the file with an index of its blocks, for BlockReader, if
+     *  on is set.
+     *  PRECONDITION: update hasn't been called.
+     */
+    void setIndex(bool on);
+
+    /** Take the next n bytes of the message at src.
+     *  Return the compressed bytes this made ready, which stay valid
+     *  until the next call. Often there are none, until a block fills up.
+     *  PRECONDITION: finish hasn't been called.
+     */
+    const std::vector<char>& update(const byte* src, size_t n);
+
+    /** End the message: compress the bytes held back and end the file.
+     *  Return the rest of the compressed bytes, which stay valid until
+     *  the compressor is destroyed.
+     */
+    const std::vector<char>& finish();
+};
+
+#endif // COMPRESSOR_HPP
@@ -0,0 +1,470 @@
+#include "ContextCoder.hpp"
+#include <algorithm>
+#include <cmath>
+
+/** Set up a coder using at most maxTables codes of at most
+ *  codeLengthLimit bits.
+ */
+ContextCoder::ContextCoder(int maxTables, int codeLengthLimit) :
+    maxTables(std::min(std::max(maxTables, 1), 256)), codeLengthLimit(codeLengthLimit), totalBytes(0), stats(0)
+{
+    //the code lengths have to fit the 4-bit code length header
+    if (this->codeLengthLimit < 1 || this->codeLengthLimit > HCTree::MAX_HEADER_CODE_LENGTH)
+        this->codeLengthLimit = HCTree::MAX_HEADER_CODE_LENGTH;
+    std::fill(this->clusterOf, this->clusterOf + 256, 0);
+}
+
+/** Add the time spent on every phase, and the counts and code lengths
+ *  of the bytes, to stats.
+ */
+void ContextCoder::setStats(Stats* stats)
+{
+    this->stats = stats;
+}
+
+/** Return about the bits the bytes with the given counts take with a
+ *  code built for them, their entropy
+ */
+static double codeBits(const long* counts)
+{
+    long total = 0;
+    for (int b = 0; b < 256; b++)
+        total += counts[b];
+
+    double bits = 0;
+    for (int b = 0; b < 256; b++)
+    {
+        if (counts[b] > 0)
+            bits += counts[b] * std::log2((double)total / counts[b]);
+    }
+    return bits;
+}
+
+/** Return the bits the code lengths of a code for the bytes with the
+ *  given counts take in the header
+ */
+static double headerBits(const long* counts)
+{
+    int first = 0, last = 255;
+    while (first < last && counts[first] == 0)
+        first++;
+    while (last > first && counts[last] == 0)
+        last--;
+    return 16 + 4 * ((last - first + 2) / 2 * 2);
+}
+
+/** Split the contexts into at most tables clusters of contexts whose
+ *  bytes code well with the same code, setting clusterOf.
+ *  Return the number of clusters.
+ */
+int ContextCoder::cluster(const std::vector<long>& counts, int tables)
+{
+    //the contexts that occur, most frequent first
+    long totals[256];
+    std::vector<int> order;
+    for (int c = 0; c < 256; c++)
+    {
+        totals[c] = 0;
+        for (int b = 0; b < 256; b++)
+            totals[c] += counts[c * 256 + b];
+        if (totals[c] > 0)
+            order.push_back(c);
+    }
+    std::stable_sort(order.begin(), order.end(), [&totals](int a, int b) { return totals[a] > totals[b]; });
+
+    //every context gets its own code if there is room, otherwise the
+    //most frequent ones start off the clusters
+    std::fill(this->clusterOf, this->clusterOf + 256, 0);
+    int k = std::min(tables, (int)order.size());
+    for (int i = 0; i < k; i++)
+        this->clusterOf[order[i]] = i;
+    if (k == (int)order.size())
+        return std::max(k, 1);
+
+    std::vector<long> sums(k * 256);
+    std::vector<double> cost(k * 256);
+    for (int round = 0; round < CLUSTER_ROUNDS; round++)
+    {
+        //add up the counts of every cluster, just the ones that start
+        //them off in the first round
+        std::fill(sums.begin(), sums.end(), 0);
+        size_t members = (round == 0) ? k : order.size();
+        for (size_t i = 0; i < members; i++)
+        {
+            int c = order[i];
+            for (int b = 0; b < 256; b++)
+                sums[this->clusterOf[c] * 256 + b] += counts[c * 256 + b];
+        }
+
+        //the bits a byte would cost with the code of every cluster,
+        //bytes the cluster hasn't seen yet being expensive but possible
+        for (int j = 0; j < k; j++)
+        {
+            long total = 0;
+            for (int b = 0; b < 256; b++)
+                total += sums[j * 256 + b];
+            for (int b = 0; b < 256; b++)
+                cost[j * 256 + b] = std::log2((total + 128.0) / (sums[j * 256 + b] + 0.5));
+        }
+
+        //move every context to the cluster that codes its bytes in the fewest bits
+        bool moved = false;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            int c = order[i];
+            const long* count = &counts[c * 256];
+            int best = 0;
+            double bestBits = 0;
+            for (int j = 0; j < k; j++)
+            {
+                const double* bits = &cost[j * 256];
+                double sum = 0;
+                for (int b = 0; b < 256; b++)
+                    sum += count[b] * bits[b];
+                if (j == 0 || sum < bestBits)
+                {
+                    best = j;
+                    bestBits = sum;
+                }
+            }
+            moved = moved || best != this->clusterOf[c];
+            this->clusterOf[c] = best;
+        }
+        if (!moved && round > 0)
+            break;
+    }
+
+    //add up the counts of the final clusters
+    std::fill(sums.begin(), sums.end(), 0);
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        int c = order[i];
+        for (int b = 0; b < 256; b++)
+            sums[this->clusterOf[c] * 256 + b] += counts[c * 256 + b];
+    }
+
+    //the bits every pair of clusters would cost more as one cluster
+    std::vector<double> bits(k);
+    std::vector<bool> live(k);
+    int liveCount = 0;
+    for (int j = 0; j < k; j++)
+    {
+        bits[j] = codeBits(&sums[j * 256]);
+        live[j] = std::count(&sums[j * 256], &sums[j * 256] + 256, 0L) < 256;
+        liveCount += live[j];
+    }
+    std::vector<double> extra(k * k);
+    long merged[256];
+    for (int i = 0; i < k; i++)
+    {
+        for (int j = i + 1; j < k; j++)
+        {
+            for (int b = 0; b < 256; b++)
+                merged[b] = sums[i * 256 + b] + sums[j * 256 + b];
+            extra[i * k + j] = codeBits(merged) - bits[i] - bits[j];
+        }
+    }
+
+    //merge the clusters whose own codes save fewer bits than their
+    //code lengths take, cheapest merge first
+    while (liveCount > 1)
+    {
+        int bestI = -1, bestJ = -1;
+        for (int i = 0; i < k; i++)
+        {
+            for (int j = i + 1; j < k && live[i]; j++)
+            {
+                if (live[j] && (bestI < 0 || extra[i * k + j] < extra[bestI * k + bestJ]))
+                {
+                    bestI = i;
+                    bestJ = j;
+                }
+            }
+        }
+
+        //a merge saves the code lengths of one code, and the last one
+        //the cluster of every context too
+        double saved = std::min(headerBits(&sums[bestI * 256]), headerBits(&sums[bestJ * 256]));
+        if (liveCount == 2)
+            saved += 8 * 256;
+        if (extra[bestI * k + bestJ] >= saved)
+            break;
+
+        //move everything of bestJ to bestI
+        for (int b = 0; b < 256; b++)
+            sums[bestI * 256 + b] += sums[bestJ * 256 + b];
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            if (this->clusterOf[order[i]] == bestJ)
+                this->clusterOf[order[i]] = bestI;
+        }
+        live[bestJ] = false;
+        liveCount--;
+
+        //and update what merging with bestI costs
+        bits[bestI] = codeBits(&sums[bestI * 256]);
+        for (int j = 0; j < k; j++)
+        {
+            if (!live[j] || j == bestI)
+                continue;
+            int lo = std::min(j, bestI), hi = std::max(j, bestI);
+            for (int b = 0; b < 256; b++)
+                merged[b] = sums[lo * 256 + b] + sums[hi * 256 + b];
+            extra[lo * k + hi] = codeBits(merged) - bits[lo] - bits[hi];
+        }
+    }
+
+    //drop the clusters every context left, keeping the others in order
+    int number[256];
+    std::fill(number, number + 256, -1);
+    for (size_t i = 0; i < order.size(); i++)
+        number[this->clusterOf[order[i]]] = 0;
+    int clusters = 0;
+    for (int j = 0; j < k; j++)
+    {
+        if (number[j] == 0)
+            number[j] = clusters++;
+    }
+    for (int c = 0; c < 256; c++)
+        this->clusterOf[c] = std::max(number[this->clusterOf[c]], 0);
+
+    return clusters;
+}
+
+/** Count the bytes at src in their contexts and build the codes.
+ */
+void ContextCoder::build(const byte* src, size_t n)
+{
+    //count every byte in the context of the byte before it
+    double start = this->stats ? Stats::now() : 0;
+    this->totalBytes = n;
+    std::vector<long> counts(256 * 256);
+    byte prev = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        counts[prev * 256 + src[i]]++;
+        prev = src[i];
+    }
+    if (this->stats != nullptr)
+        this->stats->seconds[Stats::COUNT] += Stats::now() - start;
+
+    //cluster the contexts, with fewer codes for smaller messages
+    start = this->stats ? Stats::now() : 0;
+    this->trees.clear();
+    if (n > 0)
+    {
+        long tables = std::min((long)this->maxTables, std::max(1L, (long)n / BYTES_PER_TABLE));
+        this->trees.resize(this->cluster(counts, tables));
+    }
+
+    //build the code of every cluster from the counts of its contexts
+    for (size_t j = 0; j < this->trees.size(); j++)
+    {
+        std::vector<long> freqs(256);
+        for (int c = 0; c < 256; c++)
+        {
+            if (this->clusterOf[c] != j)
+                continue;
+            for (int b = 0; b < 256; b++)
+                freqs[b] += counts[c * 256 + b];
+        }
+        this->trees[j].setCodeLengthLimit(this->codeLengthLimit);
+        this->trees[j].buildTree(freqs);
+        this->trees[j].useCanonicalCodes();
+    }
+    this->buildCodes();
+    if (this->stats != nullptr)
+        this->stats->seconds[Stats::BUILD] += Stats::now() - start;
+}
+
+/** Copy the codes of the trees into codes, where a cluster with a
+ *  single byte gets a code of no bits.
+ */
+void ContextCoder::buildCodes()
+{
+    this->codes.resize(this->trees.size() * 256);
+    for (size_t j = 0; j < this->trees.size(); j++)
+    {
+        CodeEntry* code = &this->codes[j * 256];
+        std::copy(this->trees[j].codes(), this->trees[j].codes() + 256, code);
+
+        int coded = 0;
+        for (int b = 0; b < 256; b++)
+            coded += code[b].length > 0;
+        if (coded == 1)
+        {
+            for (int b = 0; b < 256; b++)
+                code[b].length = 0;
+        }
+    }
+}
+
+/** Compress the n bytes at src into out, header first, and flush it.
+ */
+void ContextCoder::compress(BitOutputStream& out, const byte* src, size_t n)
+{
+    //write the magic number, the format version and the number of bytes
+    double start = this->stats ? Stats::now() : 0;
+    HCTree::writeFormat(out, HCTree::FORMAT_CONTEXT);
+    out.writeVarint(n);
+
+    //then the clusters of the contexts and their codes
+    if (n > 0)
+    {
+        out.writeByte(this->trees.size() - 1);
+        if (this->trees.size() > 1)
+        {
+            for (int c = 0; c < 256; c++)
+                out.writeByte(this->clusterOf[c]);
+        }
+        for (size_t j = 0; j < this->trees.size(); j++)
+            this->trees[j].writeCodeLengths(out);
+    }
+    if (this->stats != nullptr)
+        this->stats->seconds[Stats::BUILD] += Stats::now() - start;
+
+    //code every byte with the code of the byte before it
+    start = this->stats ? Stats::now() : 0;
+    const CodeEntry* contextCodes[256];
+    for (int c = 0; c < 256 && n > 0; c++)
+        contextCodes[c] = &this->codes[this->clusterOf[c] * 256];
+    byte prev = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        const CodeEntry& code = contextCodes[prev][src[i]];
+        out.writeBits(code.bits, code.length);
+        prev = src[i];
+    }
+    out.flush();
+    if (this->stats != nullptr)
+    {
+        this->stats->seconds[Stats::CODE] += Stats::now() - start;
+        this->recordCodes(src, n, 0);
+        this->stats->codedBytes += out.bytesWritten();
+    }
+}
+
+/** Read the header of a file in the context format and prepare for
+ *  decoding it.
+ *  Return false if the header is damaged.
+ */
+bool ContextCoder::readHeader(BitInputStream& in)
+{
+    double start = this->stats ? Stats::now() : 0;
+    this->trees.clear();
+    this->totalBytes = std::max(in.readVarint(), 0L);
+    if (this->totalBytes == 0)
+        return true;
+
+    //read the clusters of the contexts
+    int clusters = in.readByte() + 1;
+    if (clusters < 1)
+        return false;
+    std::fill(this->clusterOf, this->clusterOf + 256, 0);
+    for (int c = 0; c < 256 && clusters > 1; c++)
+    {
+        int j = in.readByte();
+        if (j < 0 || j >= clusters)
+            return false;
+        this->clusterOf[c] = j;
+    }
+
+    //read the code of every cluster, which has to be a prefix code
+    this->trees.resize(clusters);
+    for (int j = 0; j < clusters; j++)
+    {
+        HCTree& tree = this->trees[j];
+        tree.readCodeLengths(in);
+        long kraft = 0;
+        for (int b = 0; b < 256; b++)
+        {
+            if (tree.codes()[b].length > 0)
+                kraft += 1L << (HCTree::MAX_HEADER_CODE_LENGTH - tree.codes()[b].length);
+        }
+        if (kraft == 0 || kraft > 1L << HCTree::MAX_HEADER_CODE_LENGTH)
+            return false;
+        tree.assignCanonicalCodes();
+        tree.buildDecodeTable();
+    }
+    this->buildCodes();
+
+    if (this->stats != nullptr)
+        this->stats->seconds[Stats::BUILD] += Stats::now() - start;
+    return true;
+}
+
+/** Decode n bytes into dst, the first of them in context prev.
+ */
+void ContextCoder::decodeBytes(BitInputStream& in, byte* dst, size_t n, byte prev) const
+{
+    //every context decodes with the table of its cluster
+    const HCTree* contextTrees[256];
+    for (int c = 0; c < 256; c++)
+        contextTrees[c] = &this->trees[this->clusterOf[c]];
+
+    for (size_t i = 0; i < n; i++)
+    {
+        prev = contextTrees[prev]->tableLookup(in);
+        dst[i] = prev;
+    }
+}
+
+/** Decode the message into wStream.
+ */
+void ContextCoder::decompress(std::ostream& wStream, BitInputStream& in)
+{
+    //decode a piece at a time into a buffer, and write the buffer out
+    std::vector<byte> piece(std::min(this->totalBytes, 64L * 1024));
+    byte prev = 0;
+    for (long done = 0; done < this->totalBytes;)
+    {
+        size_t n = std::min((long)piece.size(), this->totalBytes - done);
+        double start = this->stats ? Stats::now() : 0;
+        this->decodeBytes(in, piece.data(), n, prev);
+        if (this->stats != nullptr)
+        {
+            this->stats->seconds[Stats::CODE] += Stats::now() - start;
+            this->recordCodes(piece.data(), n, prev);
+        }
+        wStream.write(reinterpret_cast<const char*>(piece.data()), n);
+        prev = piece[n - 1];
+        done += n;
+    }
+}
+
+/** Decode the message into the cap bytes at dst.
+ *  Return false, without decoding anything, if the message is larger
+ *  than cap bytes.
+ */
+bool ContextCoder::decompress(BitInputStream& in, byte* dst, size_t cap)
+{
+    if ((size_t)this->totalBytes > cap)
+        return false;
+
+    double start = this->stats ? Stats::now() : 0;
+    if (this->totalBytes > 0)
+        this->decodeBytes(in, dst, this->totalBytes, 0);
+    if (this->stats != nullptr)
+    {
+        this->stats->seconds[Stats::CODE] += Stats::now() - start;
+        this->recordCodes(dst, this->totalBytes, 0);
+    }
+
+    return true;
+}
+
+/** Add the counts of the n bytes at src, the first of them in context
+ *  prev, and the lengths of their codes to the stats.
+ */
+void ContextCoder::recordCodes(const byte* src, size_t n, byte prev) const
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        const CodeEntry& code = this->codes[this->clusterOf[prev] * 256 + src[i]];
+        this->stats->freqs[src[i]]++;
+        this->stats->payloadBits += code.length;
+        this->stats->maxCodeLength = std::max(this->stats->maxCodeLength, code.length);
+        prev = src[i];
+    }
+    this->stats->messageBytes += n;
+}
@@ -0,0 +1,116 @@
+#ifndef CONTEXTCODER_HPP
+#define CONTEXTCODER_HPP
+
+#include <iostream>
+#include <vector>
+#include "HCTree.hpp"
+#include "BitInputStream.hpp"
+#include "BitOutputStream.hpp"
+#include "Stats.hpp"
+
+/** A class for the order-1 context format (FORMAT_CONTEXT): every byte
+ *  is coded with the code of its context, the byte before it (0 for the
+ *  first byte), so text and structured data, where a byte says a lot
+ *  about the next one, code smaller than with one code for all bytes.
+ *  Contexts whose bytes look alike share a code, so there are at most
+ *  maxTables codes: the contexts are clustered by the cost of coding
+ *  their bytes with the code of every cluster, a few rounds of k-means.
+ *  Small messages get fewer codes, as every code takes header space.
+ *
+ *  File layout, after the magic number and format version:
+ *    number of bytes (varint)
+ *    if there are any: number of codes less one (1 byte), the code of
+ *      every context (256 bytes, only if there is more than one code),
+ *      the code lengths of every code as written by
+ *      HCTree::writeCodeLengths
+ *    the coded bytes
+ *  Both ways a byte costs one table lookup, like the order-0 formats.
+ */
+class ContextCoder {
+private:
+    int maxTables;                // most codes a message gets
+    int codeLengthLimit;          // longest code of a table
+    long totalBytes;              // number of bytes in the message
+    std::vector<HCTree> trees;    // the code of every cluster
+    byte clusterOf[256];          // the cluster of every context
+    std::vector<CodeEntry> codes; // the codes of every cluster, 256 per cluster
+    Stats* stats;                 // where the time and code statistics go, if anywhere
+
+    /** Split the contexts into at most tables clusters of contexts whose
+     *  bytes code well with the same code, setting clusterOf.
+     *  Return the number of clusters.
+     *  PRECONDITION: counts[c][b] is the count of byte b after byte c.
+     */
+    int cluster(const std::vector<long>& counts, int tables);
+
+    /** Copy the codes of the trees into codes, where a cluster with a
+     *  single byte gets a code of no bits, as the decoder reads none.
+     *  PRECONDITION: every tree holds its canonical codes.
+     */
+    void buildCodes();
+
+    /** Decode n bytes into dst, the first of them in context prev.
+     *  PRECONDITION: the decode tables of the trees are ready.
+     */
+    void decodeBytes(BitInputStream& in, byte* dst, size_t n, byte prev) const;
+
+    /** Add the counts of the n bytes at src, the first of them in
+     *  context prev, and the lengths of their codes to the stats.
+     */
+    void recordCodes(const byte* src, size_t n, byte prev) const;
+
+public:
+    /** Bytes of message every code after the first has to pay for, as a
+     *  code takes up to 130 bytes of header
+     */
+    static const long BYTES_PER_TABLE = 1024;
+
+    /** Rounds of k-means the contexts are clustered with
+     */
+    static const int CLUSTER_ROUNDS = 4;
+
+    /** Set up a coder using at most maxTables codes (1 to 256) of at
+     *  most codeLengthLimit bits (1 to HCTree::MAX_HEADER_CODE_LENGTH).
+     */
+    ContextCoder(int maxTables = 256, int codeLengthLimit = HCTree::MAX_HEADER_CODE_LENGTH);
+
+    /** Add the time spent on every phase, and the counts and code lengths
+     *  of the bytes, to stats.
+     */
+    void setStats(Stats* stats);
+
+    /** Count the bytes at src in their contexts and build the codes.
+     */
+    void build(const byte* src, size_t n);
+
+    /** Compress the n bytes at src into out, header first, and flush it.
+     *  PRECONDITION: build has been ran on the same bytes.
+     */
+    void compress(BitOutputStream& out, const byte* src, size_t n);
+
+    /** Read the header of a file in the context format and prepare for
+     *  decoding it.
+     *  PRECONDITION: readFormat returned HCTree::FORMAT_CONTEXT for in.
+     *  Return false if the header is damaged.
+     */
+    bool readHeader(BitInputStream& in);
+
+    /** Return the number of bytes of the message
+     *  PRECONDITION: build or readHeader has been called.
+     */
+    long messageSize() const { return this->totalBytes; }
+
+    /** Decode the message into wStream.
+     *  PRECONDITION: readHeader has read the header from in.
+     */
+    void decompress(std::ostream& wStream, BitInputStream& in);
+
+    /** Decode the message into the cap bytes at dst.
+     *  PRECONDITION: readHeader has read the header from in.
+     *  Return false, without decoding anything, if the message is larger
+     *  than cap bytes.
+     */
+    bool decompress(BitInputStream& in, byte* dst, size_t cap);
+};
+
+#endif // CONTEXTCODER_HPP
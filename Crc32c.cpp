@@ -0,0 +1,117 @@
+#include "Crc32c.hpp"
+
+//the crc32 instruction is picked at runtime on x86 with gcc or clang
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CRC32C_SSE42
+#endif
+
+/** The Castagnoli polynomial, bit reversed
+ */
+static const uint32_t POLYNOMIAL = 0x82F63B78;
+
+/** The slicing-by-8 tables: table[0] is the CRC of every byte, and
+ *  table[k] the CRC of every byte followed by k zero bytes.
+ */
+struct CrcTables {
+    uint32_t table[8][256];
+
+    CrcTables()
+    {
+        //the CRC of every byte, a bit at a time
+        for (int i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ ((crc & 1) ? POLYNOMIAL : 0);
+            this->table[0][i] = crc;
+        }
+
+        //every further table moves the CRC along one more byte
+        for (int k = 1; k < 8; k++)
+        {
+            for (int i = 0; i < 256; i++)
+            {
+                uint32_t crc = this->table[k - 1][i];
+                this->table[k][i] = (crc >> 8) ^ this->table[0][crc & 255];
+            }
+        }
+    }
+};
+
+/** Return the CRC32C of the n bytes at src, starting from the
+ *  uninverted crc, 8 bytes at a time with the slicing-by-8 tables.
+ */
+static uint32_t crcSlicing8(uint32_t crc, const byte* src, size_t n)
+{
+    static const CrcTables tables;
+    const uint32_t (*t)[256] = tables.table;
+
+    for (; n >= 8; n -= 8, src += 8)
+    {
+        //the 8 bytes in little endian order, the first 4 folded into the crc
+        uint32_t low = crc ^ (src[0] | (src[1] << 8) | (src[2] << 16) | ((uint32_t)src[3] << 24));
+        uint32_t high = src[4] | (src[5] << 8) | (src[6] << 16) | ((uint32_t)src[7] << 24);
+
+        //look up all 8 bytes at once, each in the table of its distance to the end
+        crc = t[7][low & 255] ^ t[6][(low >> 8) & 255] ^ t[5][(low >> 16) & 255] ^ t[4][low >> 24] ^
+              t[3][high & 255] ^ t[2][(high >> 8) & 255] ^ t[1][(high >> 16) & 255] ^ t[0][high >> 24];
+    }
+
+    //the bytes left over, one at a time
+    for (; n > 0; n--, src++)
+        crc = (crc >> 8) ^ t[0][(crc ^ *src) & 255];
+
+    return crc;
+}
+
+#ifdef CRC32C_SSE42
+/** Return the CRC32C of the n bytes at src, starting from the
+ *  uninverted crc, with the crc32 instruction.
+ *  PRECONDITION: the cpu supports SSE4.2.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crcSse42(uint32_t crc, const byte* src, size_t n)
+{
+#ifdef __x86_64__
+    //8 bytes per instruction
+    uint64_t crc64 = crc;
+    for (; n >= 8; n -= 8, src += 8)
+    {
+        uint64_t v;
+        __builtin_memcpy(&v, src, 8);
+        crc64 = _mm_crc32_u64(crc64, v);
+    }
+    crc = (uint32_t)crc64;
+#else
+    //4 bytes per instruction
+    for (; n >= 4; n -= 4, src += 4)
+    {
+        uint32_t v;
+        __builtin_memcpy(&v, src, 4);
+        crc = _mm_crc32_u32(crc, v);
+    }
+#endif
+
+    //the bytes left over, one at a time
+    for (; n > 0; n--, src++)
+        crc = _mm_crc32_u8(crc, *src);
+
+    return crc;
+}
+#endif
+
+/** Return the CRC32C of the n bytes at src. To checksum bytes in
+ *  pieces, pass the CRC of the bytes before them as crc.
+ */
+uint32_t Crc32c::compute(const byte* src, size_t n, uint32_t crc)
+{
+#ifdef CRC32C_SSE42
+    //use the crc32 instruction if the cpu has it
+    static const bool sse42 = __builtin_cpu_supports("sse4.2");
+    if (sse42)
+        return ~crcSse42(~crc, src, n);
+#endif
+
+    return ~crcSlicing8(~crc, src, n);
+}
@@ -0,0 +1,21 @@
+#ifndef CRC32C_HPP
+#define CRC32C_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include "HCNode.hpp"
+
+/** CRC32C (the Castagnoli polynomial), the checksum of the blocks of
+ *  blocked files. Computed with the crc32 instruction of SSE4.2 when
+ *  the cpu has it, and with slicing-by-8 tables otherwise, which give
+ *  the same checksums.
+ */
+class Crc32c {
+public:
+    /** Return the CRC32C of the n bytes at src. To checksum bytes in
+     *  pieces, pass the CRC of the bytes before them as crc.
+     */
+    static uint32_t compute(const byte* src, size_t n, uint32_t crc = 0);
+};
+
+#endif // CRC32C_HPP
@@ -0,0 +1,185 @@
+#include "Decompressor.hpp"
+#include "BitInputStream.hpp"
+#include "BlockCoder.hpp"
+#include "Crc32c.hpp"
+
+Decompressor::Decompressor() :
+    state(EXPECT_HEADER), streams(1), checksums(false), indexed(false), maxBlock(0), damaged(false) { }
+
+/** Read a varint at src[pos], with n bytes in src, into v and move
+ *  pos past it. Return false, leaving pos as it was, if the varint
+ *  isn't complete. A varint running past 64 bits is damaged, and
+ *  reads as -1, as no size is negative.
+ */
+bool Decompressor::readVarint(const char* src, size_t n, size_t& pos, long& v)
+{
+    //7 bits per byte, least significant first, until a byte without the top bit
+    unsigned long value = 0;
+    size_t i = pos, shift = 0;
+    for (; i < n && shift < 64; i++, shift += 7)
+    {
+        unsigned char b = src[i];
+        value |= (unsigned long)(b & 127) << shift;
+        if ((b & 128) == 0)
+        {
+            v = value;
+            pos = i + 1;
+            return true;
+        }
+    }
+
+    //more input can't complete a varint that is already too long
+    if (shift < 64)
+        return false;
+    v = -1;
+    pos = i;
+    return true;
+}
+
+/** Decompress everything complete among the n bytes at src into output.
+ *  Return the number of bytes used, the rest has to wait for more.
+ */
+size_t Decompressor::decode(const char* src, size_t n)
+{
+    size_t pos = 0;
+    while (!this->damaged && pos < n)
+    {
+        //nothing but the index may follow the end of the file, and the
+        //index isn't needed to decompress it all
+        if (this->state == EXPECT_NOTHING)
+        {
+            if (this->indexed)
+                pos = n;
+            else
+                this->damaged = true;
+            break;
+        }
+
+        //read ahead from pos, and only move pos once a whole part is in
+        size_t next = pos;
+
+        if (this->state == EXPECT_HEADER)
+        {
+            //the magic number and format version, then the block size
+            if (n - next < 4)
+                break;
+            next += 4;
+            if (!readVarint(src, n, next, this->maxBlock))
+                break;
+
+            const byte* head = reinterpret_cast<const byte*>(src + pos);
+            int magic = (head[0] << 16) | (head[1] << 8) | head[2];
+            int format = head[3] & ~(HCTree::FORMAT_CHECKSUM | HCTree::FORMAT_INDEX);
+            if (magic != HCTree::FORMAT_MAGIC || this->maxBlock < 1 || this->maxBlock > BlockCoder::MAX_BLOCK_SIZE ||
+                (format != HCTree::FORMAT_BLOCKED && format != HCTree::FORMAT_STREAMS))
+            {
+                this->damaged = true;
+                break;
+            }
+
+            this->streams = (format == HCTree::FORMAT_STREAMS) ? HCTree::BLOCK_STREAMS : 1;
+            this->checksums = (head[3] & HCTree::FORMAT_CHECKSUM) != 0;
+            this->indexed = (head[3] & HCTree::FORMAT_INDEX) != 0;
+            this->state = EXPECT_BLOCK;
+            pos = next;
+            continue;
+        }
+
+        //the raw size of the block, 0 ends the file
+        long rawSize, bodySize;
+        if (!readVarint(src, n, next, rawSize))
+            break;
+        if (rawSize == 0)
+        {
+            this->state = EXPECT_NOTHING;
+            pos = next;
+            continue;
+        }
+        if (rawSize < 0 || rawSize > this->maxBlock)
+        {
+            this->damaged = true;
+            break;
+        }
+
+        //the body size, then the body
+        if (!readVarint(src, n, next, bodySize))
+            break;
+        if (bodySize < 0 || bodySize > rawSize + BlockCoder::MAX_BODY_OVERHEAD)
+        {
+            this->damaged = true;
+            break;
+        }
+        //the checksum, then the body
+        size_t crcSize = this->checksums ? 4 : 0;
+        if (n - next < crcSize + bodySize)
+            break;
+        const byte* crc = reinterpret_cast<const byte*>(src + next);
+        next += crcSize;
+
+        //decode the block with the code in its code lengths
+        HCTree codeTree;
+        BitInputStream in(src + next, bodySize);
+        size_t at = this->output.size();
+        this->output.resize(at + rawSize);
+        codeTree.decompressBlock(in, &this->output[at], rawSize, this->streams);
+
+        //a block that doesn't match its checksum is dropped
+        if (this->checksums && Crc32c::compute(&this->output[at], rawSize) !=
+            (crc[0] | (crc[1] << 8) | (crc[2] << 16) | ((uint32_t)crc[3] << 24)))
+        {
+            this->output.resize(at);
+            this->damaged = true;
+            break;
+        }
+        pos = next + bodySize;
+    }
+
+    return pos;
+}
+
+/** Take the next n bytes of the compressed file at src.
+ *  Return the message bytes this made ready, which stay valid
+ *  until the next call.
+ */
+const std::vector<byte>& Decompressor::update(const char* src, size_t n)
+{
+    this->output.clear();
+
+    //blocks that arrive whole are decoded in place, the rest of a
+    //block is added to the part that arrived before
+    const char* data = src;
+    size_t size = n;
+    if (!this->input.empty())
+    {
+        this->input.insert(this->input.end(), src, src + n);
+        data = this->input.data();
+        size = this->input.size();
+    }
+
+    //keep what couldn't be used yet for the next call, unless
+    //nothing more can be decoded
+    size_t used = this->decode(data, size);
+    if (this->damaged)
+        used = size;
+    if (data == src)
+        this->input.assign(src + used, src + size);
+    else
+        this->input.erase(this->input.begin(), this->input.begin() + used);
+
+    return this->output;
+}
+
+/** Return true if the whole file has arrived, and it wasn't damaged.
+ */
+bool Decompressor::finish() const
+{
+    return this->state == EXPECT_NOTHING && !this->damaged;
+}
+
+/** Return true if the file turned out to be damaged, or isn't a
+ *  blocked file.
+ */
+bool Decompressor::failed() const
+{
+    return this->damaged;
+}
@@ -0,0 +1,64 @@
+#ifndef DECOMPRESSOR_HPP
+#define DECOMPRESSOR_HPP
+
+#include <vector>
+#include "HCTree.hpp"
+
+/** A class for decompressing a blocked file (FORMAT_BLOCKED or
+ *  FORMAT_STREAMS) that arrives a piece at a time, like the payload of
+ *  a socket.
+ *  Every block is decompressed as soon as all of its bytes are in, and
+ *  checked against its checksum if the file has them, so
+ *  at most one block of the file is held at a time. Pieces may end
+ *  anywhere, even inside a block size.
+ */
+class Decompressor {
+private:
+    /** What the decompressor expects next
+     */
+    static const int EXPECT_HEADER = 0;  // the magic number, format version and block size
+    static const int EXPECT_BLOCK = 1;   // the sizes and body of a block, or the end
+    static const int EXPECT_NOTHING = 2; // the file has ended
+
+    std::vector<char> input;   // bytes of a block that hasn't fully arrived yet
+    std::vector<byte> output;  // message bytes made ready by the last call
+    int state;                 // what is expected next
+    int streams;               // number of streams every block is coded as
+    bool checksums;            // set if every block carries a CRC32C
+    bool indexed;              // set if the file ends with an index of its blocks
+    long maxBlock;             // block size of the file, no block may be larger
+    bool damaged;              // set once the file turned out to be damaged
+
+    /** Decompress everything complete among the n bytes at src into output.
+     *  Return the number of bytes used, the rest has to wait for more.
+     */
+    size_t decode(const char* src, size_t n);
+
+    /** Read a varint at src[pos], with n bytes in src, into v and move
+     *  pos past it. Return false, leaving pos as it was, if the varint
+     *  isn't complete. A varint running past 64 bits is damaged, and
+     *  reads as -1, as no size is negative.
+     */
+    static bool readVarint(const char* src, size_t n, size_t& pos, long& v);
+
+public:
+    Decompressor();
+
+    /** Take the next n bytes of the compressed file at src.
+     *  Return the message bytes this made ready, which stay valid
+     *  until the next call.
+     */
+    const std::vector<byte>& update(const char* src, size_t n);
+
+    /** Return true if the whole file has arrived, and it wasn't damaged.
+     */
+    bool finish() const;
+
+    /** Return true if the file turned out to be damaged, or isn't a
+     *  blocked file. Nothing is decompressed from there on, and the
+     *  damaged block itself isn't handed out.
+     */
+    bool failed() const;
+};
+
+#endif // DECOMPRESSOR_HPP
@@ -1,98 +1,28 @@
 #ifndef HCNODE_HPP
 #define HCNODE_HPP
 
-#include <iostream>
+#include <cstdint>
 
 typedef unsigned char byte;
 
-/** A class, instances of which are nodes in an HCTree.
+/** A node of an HCTree, kept in the node arena of its tree.
+ *  Nodes refer to each other by their index in the arena, so a node
+ *  takes 8 bytes and a whole trie of 511 nodes fits in 4 KB. The counts
+ *  of the nodes are only needed while building, and are kept apart.
  */
-class HCNode {
-    //friend comparison function to allow comparisons from outside the class
-    friend bool comp(HCNode* one, HCNode* other){return *one < *other;};
-
-private:
-    long count;
-    byte symbol; // byte in the file we're keeping track of
-    HCNode* c0;  // pointer to '0' child
-    HCNode* c1;  // pointer to '1' child
-    HCNode* p;   // pointer to parent
-
-public:
-    // default constructor
-    HCNode(long count, byte symbol, HCNode* c0 = 0, HCNode* c1 = 0, HCNode* p = 0):
-        count(count), symbol(symbol), c0(c0), c1(c1), p(p) { };
-
-    // constructor for non-leaf nodes
-    HCNode(long count): count(count), symbol(0), c0(0), c1(0), p(0) { };
-
-    //destructor
-    virtual ~HCNode();
-
-    /** Less-than comparison, so HCNodes will work in std::priority_queue
-     **  We want small counts to have high priority.
-     **  And we want to break ties deterministically.
-     **/
-    bool operator<(const HCNode& other);
-
-    /** function to return value of byte
+struct HCNode {
+    /** Index standing for no node
      */
-    const byte getValue();
+    static const uint16_t NONE = 0xFFFF;
 
-    /** function to set value of byte
-     */
-    void setValue(byte& sym );
-
-    /** function to return value of count
-     */
-    const long getCount();
-
-    /** function to set value of count
-     */
-    void setCount(long c );
-
-    /** function to set value of 0 child
-     */
-    void setC0(HCNode * const c0);
+    uint16_t c0;  // index of the '0' child
+    uint16_t c1;  // index of the '1' child
+    uint16_t p;   // index of the parent
+    byte symbol;  // byte in the file we're keeping track of, 0 for internal nodes
 
-    /** function to set value of 1 child
+    /** function to check if the node is a leaf
      */
-    void setC1(HCNode * const c1);
-
-    /** function to set value of parent node
-     */
-    void setP(HCNode * const p);
-
-    /** function to return pointer to 0 child
-     */
-    HCNode* getC0() const;
-
-    /** function to return pointer to 0 child
-     */
-    HCNode* getC1() const;
-
-    /** function to return pointer to 0 child
-     */
-    HCNode* getP() const;
-
-    /** implementation of public function to print out HCNode contents
-     */
-    virtual void printNode(std::ostream& stm) const
-    {
-         stm << "[" << this->count << "," << this->symbol << "]";
-    };
+    bool isLeaf() const { return this->c0 == NONE && this->c1 == NONE; }
 };
 
-/** For printing an HCNode to an ostream
- *  Possibly useful for debugging.
- */
-std::ostream& operator<<(std::ostream&, const HCNode&) __attribute__((weak)); // shut the linker up
-std::ostream& operator<<(std::ostream& stm, const HCNode& n)
-{
-    // call printNode function to prepare stream
-    n.printNode(stm);
-    // return stream
-    return stm;
-}
-
 #endif // HCNODE_HPP
@@ -1,13 +1,39 @@
 #include "HCTree.hpp"
 #include "BitInputStream.hpp"
 #include "BitOutputStream.hpp"
+#include "ThreadPool.hpp"
+#include "Crc32c.hpp"
+#include <cstring>
+
+//the vector byte counting kernel is picked at runtime on x86 with gcc or clang
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HCTREE_COUNT_AVX2
+#endif
 
 /** implementation of default destructor
  */
 HCTree::~HCTree()
 {
     //delete the entire tree
-    deleteTree(this->root);
+    deleteTree();
+}
+
+/** Forget the code, so the tree can build or read another one,
+ *  keeping the memory of the decode table.
+ */
+void HCTree::reset()
+{
+    this->deleteTree();
+    for (int i = 0; i < 256; i++)
+    {
+        this->codeTable[i].bits = 0;
+        this->codeTable[i].length = 0;
+    }
+    this->decodeTable.clear();
+    this->decodeBits = 0;
+    this->maxCodeLength = 0;
+    this->totalBytes = 0;
 }
 
 /** Use the Huffman algorithm to build a Huffman coding trie.
@@ -16,6 +42,8 @@ HCTree::~HCTree()
  *  s points to a uncompressed file.
  *  POSTCONDITION:  root points to the root of the trie,
  *  and leaves[i] points to the leaf node containing byte i.
+ *  If the trie has codes longer than codeLengthLimit, codeTable holds
+ *  length-limited canonical codes that no longer follow the trie.
  */
 void HCTree::build(std::vector<long>& freqs, istream& rStream)
 {
@@ -23,155 +51,288 @@ void HCTree::build(std::vector<long>& freqs, istream& rStream)
     BitInputStream in(rStream);
 
     //calculate the frequency of characters in the stream
+    double start = this->stats ? Stats::now() : 0;
     this->charCount(freqs, in);
+    this->addTime(Stats::COUNT, start);
 
-    //create a priority queue of HCNodes and create nodes for
-    //all the bytes found in the file
-    std::priority_queue<HCNode*,std::vector<HCNode*>,HCNodePtrComp> pq;
-    for (int i = 0; i < 256; i++ )
-    {
-        //if the current byte has a positive frequency
-        if (freqs[i] != 0)
-        {
-            //create a node for it and push the node onto the queue
-            HCNode* h = new HCNode(freqs[i],i);
-            this->leaves[i] = h;
-            pq.push(this->leaves[i]);
-            //release heap memory
-            h = nullptr;
-            delete h;
-        }
-    }
+    //build the trie from the frequencies
+    start = this->stats ? Stats::now() : 0;
+    this->buildTree(freqs);
+    this->addTime(Stats::BUILD, start);
+}
 
-    //while there is more than one node/tree in the queue or
-    //there is just one node in the queue and it isn't the root node
-    while (pq.size() > 1 || pq.top()->getValue())
-    {
-        //create a new empty node
-        HCNode* temp1 = new HCNode(0);
+/** Use the Huffman algorithm to build a Huffman coding trie for the
+ *  n bytes at src, read in place, counting them on the given number
+ *  of threads (below 1 for one per hardware thread).
+ *  PRECONDITION: freqs is a vector of 256 zeros.
+ *  POSTCONDITION: as for build.
+ */
+void HCTree::build(std::vector<long>& freqs, const byte* src, size_t n, int threads)
+{
+    //calculate the frequency of the bytes
+    double start = this->stats ? Stats::now() : 0;
+    charCount(freqs, src, n, threads);
+    this->addTime(Stats::COUNT, start);
+
+    //build the trie from the frequencies
+    start = this->stats ? Stats::now() : 0;
+    this->buildTree(freqs);
+    this->addTime(Stats::BUILD, start);
+}
+
+/** Use the Huffman algorithm to build a Huffman coding trie from
+ *  frequencies that have already been counted.
+ *  PRECONDITION: freqs[i] is the frequency of occurrence of byte i
+ *  in the message.
+ *  POSTCONDITION: as for build.
+ */
+void HCTree::buildTree(std::vector<long>& freqs)
+{
+    //add up the number of bytes in the stream
+    this->totalBytes = 0;
+    for (int i = 0; i < 256; i++)
+        this->totalBytes += freqs[i];
 
-        //set the new node's 0 child
-        temp1->setC0(pq.top());
-        //remove the 0 child from the queue
-        pq.pop();
-        //set the 0 child's parent
-        temp1->getC0()->setP(temp1);
-        //set the parent node's count to be the child's count
-        temp1->setCount(temp1->getC0()->getCount());
+    //build the trie, merging the two lightest trees in sorted order
+    this->buildTrie(freqs, false);
 
-        //if there isn't just one node in the queue
-        if (!pq.empty())
-        {
-            //set the new node's 1 child
-            temp1->setC1(pq.top());
-            //remove the 1 child from the queue
-            pq.pop();
-            //set the 1 child's parent
-            temp1->getC1()->setP(temp1);
-
-            //set the parent node's count to be the sum of the count of it's children
-            temp1->setCount(temp1->getCount()+temp1->getC1()->getCount());
-        }
+    //if the trie is empty, there is nothing to code
+    if (this->root == HCNode::NONE)
+        return;
 
-        //push the new node onto the queue
-        pq.push(temp1);
+    //build the lookup table for encoding
+    this->buildCodeTable();
 
-        //memory clean up
-        temp1 = nullptr;
-        delete temp1;
+    //codes too long for the canonical header go out with the legacy
+    //header, and the decoder rebuilds the trie of those in priority
+    //queue order, so build that trie instead
+    bool limited = this->codeLengthLimit > 0 && this->maxCodeLength > this->codeLengthLimit;
+    if (this->maxCodeLength > MAX_HEADER_CODE_LENGTH && !limited)
+    {
+        this->buildTrie(freqs, true);
+        this->buildCodeTable();
+        limited = this->codeLengthLimit > 0 && this->maxCodeLength > this->codeLengthLimit;
     }
 
-    //if the queue isn't empty
-    if (!pq.empty())
+    //if the trie has codes longer than the limit, switch to the
+    //best canonical code within the limit instead
+    if (limited)
     {
-        //now that the tree is constructed, set the HCTree object's root and
-        //pop it from the queue
-        this->setRoot(pq.top());
-        pq.pop();
+        this->limitCodeLengths(freqs);
+        this->assignCanonicalCodes();
     }
+
+    //build the lookup table for decoding
+    this->buildDecodeTable();
 }
 
-/** Use the Huffman algorithm to build a Huffman coding trie.
- *  PRECONDITION: freqs is a vector of ints, such that freqs[i] is
- *  the frequency of occurrence of byte i in the message and
- *  s points to a compressed file
- *  POSTCONDITION:  root points to the root of the trie,
- *  and leaves[i] points to the leaf node containing byte i.
- *  The number of bytes from the original uncompressed file is returned
+/** Build the Huffman trie of the bytes with a positive frequency in the
+ *  node arena. In sorted order, the counts are sorted once and the two
+ *  lightest trees are taken from the front of the sorted leaves or of
+ *  the merged trees, which are made in order of weight. In legacy order,
+ *  the trees are merged in the order of the priority queue of node
+ *  pointers legacy files were written with.
+ *  POSTCONDITION: root is the root of the trie, or HCNode::NONE if
+ *  no byte has a positive frequency, and leaves[i] is the leaf
+ *  node containing byte i.
  */
-void HCTree::build2(std::vector<long>& freqs, std::istream& rStream)
+void HCTree::buildTrie(const std::vector<long>& freqs, bool legacyOrder)
 {
-    //create a bit input stream from the passed in istream
-    BitInputStream in(rStream);
-
-    //determine the number of unique bytes, what they are and
-    //their frequencies in the original uncompressed file from
-    //the header of the compressed file
-    this->charCount2(freqs, in);
+    //hand back the nodes of any earlier trie
+    this->deleteTree();
 
-    //create a priority queue of HCNodes and create nodes for
-    //all the bytes found in the file
-    std::priority_queue<HCNode*,std::vector<HCNode*>,HCNodePtrComp> pq;
-    for (int i = 0; i < 256; i++ )
+    //create leaves for all the bytes found in the file, in byte order
+    int queue[256];
+    int n = 0;
+    for (int i = 0; i < 256; i++)
     {
-        //if the current byte has a positive frequency
         if (freqs[i] != 0)
         {
-            //create a node for it and push the node onto the queue
-            HCNode* h = new HCNode(freqs[i],i);
-            this->leaves[i] = h;
-            pq.push(this->leaves[i]);
-            //release heap memory
-            h = nullptr;
-            delete h;
+            this->leaves[i] = this->newNode(freqs[i], i);
+            queue[n++] = this->leaves[i];
         }
     }
 
-    //if the queue isn't empty
-    if (!pq.empty())
+    if (n == 0)
+        return;
+
+    //a node is lighter than another if it has a smaller count, and ties
+    //go to the smaller byte (internal nodes count as byte 0)
+    HCNode* nodes = this->nodes;
+    long* weights = this->weights;
+    auto lighter = [nodes, weights](int a, int b)
     {
-        //while there is more than one node/tree in the queue or
-        //there is just one node in the queue and it isn't the root node
-        while (pq.size() > 1 || pq.top()->getValue())
+        if (weights[a] != weights[b])
+            return weights[a] < weights[b];
+        return nodes[a].symbol < nodes[b].symbol;
+    };
+
+    if (legacyOrder)
+    {
+        //push the leaves onto a heap with the comparison of the old
+        //priority queue, which kept the lightest node on top
+        auto comp = [&lighter](int a, int b) { return !lighter(a, b); };
+        int size = 0;
+        for (int i = 0; i < n; i++)
+        {
+            queue[size++] = queue[i];
+            std::push_heap(queue, queue + size, comp);
+        }
+
+        //while there is more than one node/tree in the heap or
+        //there is just one node in the heap and it isn't the root node
+        while (size > 1 || nodes[queue[0]].symbol)
         {
             //create a new empty node
-            HCNode* temp1 = new HCNode(0);
-
-            //set the new node's 0 child
-            temp1->setC0(pq.top());
-            //remove the 0 child from the queue
-            pq.pop();
-            //set the 0 child's parent
-            temp1->getC0()->setP(temp1);
-            //set the parent node's count to be the child's count
-            temp1->setCount(temp1->getC0()->getCount());
-
-            //if there isn't just one node in the queue
-            if (!pq.empty())
+            int parent = this->newNode(0, 0);
+
+            //take the lightest tree as the 0 child
+            std::pop_heap(queue, queue + size--, comp);
+            int c0 = queue[size];
+            nodes[parent].c0 = c0;
+            nodes[c0].p = parent;
+            weights[parent] = weights[c0];
+
+            //if there isn't just one node in the heap, take the next
+            //lightest as the 1 child
+            if (size > 0)
             {
-                //set the new node's 1 child
-                temp1->setC1(pq.top());
-                //remove the 1 child from the queue
-                pq.pop();
-                //set the 1 child's parent
-                temp1->getC1()->setP(temp1);
-
-                //set the new node's count to be the sum of the count of it's children
-                temp1->setCount(temp1->getCount()+temp1->getC1()->getCount());
+                std::pop_heap(queue, queue + size--, comp);
+                int c1 = queue[size];
+                nodes[parent].c1 = c1;
+                nodes[c1].p = parent;
+                weights[parent] += weights[c1];
             }
-            //push the new node onto the queue
-            pq.push(temp1);
 
-            //memory clean up
-            temp1 = nullptr;
-            delete temp1;
+            //push the new node onto the heap
+            queue[size++] = parent;
+            std::push_heap(queue, queue + size, comp);
         }
 
-        //now that the tree is constructed, set the HCTree object's root and
-        //pop it from the queue
-        this->setRoot(pq.top());
-        pq.pop();
+        this->setRoot(queue[0]);
+        return;
+    }
+
+    //sort the leaves by count, and by byte to break ties
+    std::sort(queue, queue + n, lighter);
+
+    //the merged trees come out in order of weight, so the lightest tree
+    //is always at the front of the leaves or of the merged trees
+    int merged[256];
+    int leafi = 0, mergedi = 0, mergedn = 0;
+    auto lightest = [&]()
+    {
+        if (mergedi == mergedn || (leafi < n && weights[queue[leafi]] <= weights[merged[mergedi]]))
+            return queue[leafi++];
+        return merged[mergedi++];
+    };
+
+    //a single leaf is the whole trie, otherwise merge the two
+    //lightest trees until one is left
+    int top = queue[0];
+    for (int i = 1; i < n; i++)
+    {
+        int c0 = lightest();
+        int c1 = lightest();
+
+        top = this->newNode(weights[c0] + weights[c1], 0);
+        nodes[top].c0 = c0;
+        nodes[top].c1 = c1;
+        nodes[c0].p = top;
+        nodes[c1].p = top;
+        merged[mergedn++] = top;
+    }
+
+    this->setRoot(top);
+}
+
+/** Take the next node of the arena, set it up as a leaf with the
+ *  given count and byte, and return its index.
+ */
+int HCTree::newNode(long count, byte symbol)
+{
+    int i = this->nodeCount++;
+    this->nodes[i].c0 = HCNode::NONE;
+    this->nodes[i].c1 = HCNode::NONE;
+    this->nodes[i].p = HCNode::NONE;
+    this->nodes[i].symbol = symbol;
+    this->weights[i] = count;
+    return i;
+}
+
+/** Read the header of a compressed file and prepare for decoding it.
+ *  PRECONDITION: freqs is a vector of 256 zeros, in reads a compressed
+ *  file and format is the version readFormat returned for it.
+ *  POSTCONDITION: for a legacy file, freqs[i] is the frequency of
+ *  byte i, root points to the root of the trie and leaves[i] points to
+ *  the leaf node containing byte i. For a canonical file, the code
+ *  lengths are read instead and no trie is built.
+ *  Either way the decode table is ready and in is positioned at the
+ *  start of the compressed data.
+ *  Return false if the format has no single code table.
+ */
+bool HCTree::build2(std::vector<long>& freqs, BitInputStream& in, int format)
+{
+    double start = this->stats ? Stats::now() : 0;
+
+    //canonical files store the number of bytes and the code lengths
+    if (format == FORMAT_CANONICAL)
+    {
+        //an empty (or truncated) message has no codes
+        this->totalBytes = std::max(in.readVarint(), 0L);
+        if (this->totalBytes == 0)
+            return true;
+
+        //rebuild the codes straight from the code lengths in the header
+        this->readCodeLengths(in);
+        this->assignCanonicalCodes();
+        this->buildDecodeTable();
+        this->addTime(Stats::BUILD, start);
+        return true;
+    }
+
+    //files coded with a shared table only store its id and the number
+    //of bytes, the code comes from the table loaded before
+    if (format == FORMAT_SHARED)
+    {
+        byte id[4];
+        for (int k = 0; k < 4; k++)
+            id[k] = in.readByte();
+        if (this->decodeTable.empty() ||
+            (id[0] | (id[1] << 8) | (id[2] << 16) | ((uint32_t)id[3] << 24)) != this->tableId())
+            return false;
+
+        this->totalBytes = std::max(in.readVarint(), 0L);
+        this->addTime(Stats::BUILD, start);
+        return true;
     }
+
+    //the only other format with a single code table is the legacy one
+    if (format != FORMAT_LEGACY)
+        return false;
+
+    //this is a legacy file: determine the number of unique
+    //bytes, what they are and their frequencies in the original
+    //uncompressed file from the header of the compressed file
+    this->charCount2(freqs, in);
+
+    //add up the number of bytes in the original file
+    this->totalBytes = 0;
+    for (int i = 0; i < 256; i++)
+        this->totalBytes += freqs[i];
+
+    //rebuild the trie the legacy encoder used
+    this->buildTrie(freqs, true);
+
+    //if the trie isn't empty, build the lookup tables for encoding and decoding
+    if (this->root != HCNode::NONE)
+    {
+        this->buildCodeTable();
+        this->buildDecodeTable();
+    }
+
+    this->addTime(Stats::BUILD, start);
+    return true;
 }
 
 /** Use the Huffman tree to create the output file.
@@ -182,55 +343,529 @@ void HCTree::build2(std::vector<long>& freqs, std::istream& rStream)
  */
 void HCTree::compress(std::ostream& wStream, std::istream& rStream)
 {
-    //variable to hold the number of unique bytes in the input file
-    //if all 256 bytes are used, we need to store it as 255 because 256
-    //doesn't fit in a single byte
-    int uniqueBytes = (this->leafCount() - 1);
+    //create an output stream object and write the header
+    double start = this->stats ? Stats::now() : 0;
+    BitOutputStream out(wStream);
+    this->writeHeader(out);
+
+    //a single repeated byte is fully described by the header,
+    //otherwise write the huffman code translation of the input file to the output file
+    if (this->leafCount() > 1)
+    {
+        BitInputStream in(rStream);
 
-    //create an output stream object
+        //read in the first byte
+        int i = in.readByte();
+
+        //while not eof
+        while (i != -1)
+        {
+            //convert the int to a byte
+            byte b = i;
+
+            //write the compressed verion of the current byte to the output file
+            encode(b,out);
+
+            //read in the next byte
+            i = in.readByte();
+        }
+    }
+
+    //flush the output buffer one last time to write any remaining bits to the output file
+    out.flush();
+    this->addTime(Stats::CODE, start);
+
+    //the counts of the bytes coded are the counts of the leaves
+    if (this->stats != nullptr)
+    {
+        long counts[256];
+        this->leafCounts(counts);
+        this->recordCode(counts);
+        this->stats->codedBytes += out.bytesWritten();
+    }
+}
+
+/** Use the Huffman tree to compress the n bytes at src, read in place.
+ *  PRECONDITION: build has been ran on the same bytes.
+ *  POSTCONDITION: as for compress.
+ */
+void HCTree::compress(std::ostream& wStream, const byte* src, size_t n)
+{
+    //create an output stream object and compress into it
     BitOutputStream out(wStream);
+    this->compress(out, src, n);
+}
 
-    //if the input file wasn't empty, write compressed code to output file
-    if (uniqueBytes >= 0)
+/** Use the Huffman tree to compress the n bytes at src, read in place,
+ *  into out, and flush it.
+ *  PRECONDITION: build has been ran on the same bytes.
+ */
+void HCTree::compress(BitOutputStream& out, const byte* src, size_t n)
+{
+    //write the header
+    double start = this->stats ? Stats::now() : 0;
+    this->writeHeader(out);
+
+    //a single repeated byte is fully described by the header
+    if (this->leafCount() > 1)
+    {
+        for (size_t i = 0; i < n; i++)
+            this->encode(src[i], out);
+    }
+
+    //write any remaining bits to the output file
+    out.flush();
+    this->addTime(Stats::CODE, start);
+
+    //the counts of the bytes coded are the counts of the leaves
+    if (this->stats != nullptr)
+    {
+        long counts[256];
+        this->leafCounts(counts);
+        this->recordCode(counts);
+        this->stats->codedBytes += out.bytesWritten();
+    }
+}
+
+/** Write the header compress starts the output file with, switching
+ *  to canonical codes if the canonical header is used.
+ *  PRECONDITION: build has been ran to create a Huffman tree.
+ */
+void HCTree::writeHeader(BitOutputStream& out)
+{
+    //if the code lengths fit in the compact header, switch to
+    //canonical codes and write the canonical header
+    if (this->maxCodeLength <= MAX_HEADER_CODE_LENGTH)
+    {
+        this->useCanonicalCodes();
+
+        //write the magic number, the format version and the number of bytes
+        writeFormat(out, FORMAT_CANONICAL);
+        out.writeVarint(this->totalBytes);
+
+        //an empty message has no codes
+        if (this->totalBytes > 0)
+            this->writeCodeLengths(out);
+    }
+    //otherwise fall back to the legacy header with the frequencies
+    else
     {
         //write the number of unique bytes to the output file
-        out.writeByte(uniqueBytes);
+        //if all 256 bytes are used, we need to store it as 255 because 256
+        //doesn't fit in a single byte
+        out.writeByte(this->leafCount() - 1);
 
         //cycle through leaves and write the non-null values to the output file
         for (int i = 0; i < 256; i++)
         {
-            if (leaves[i] != nullptr)
-                out.writeByte(leaves[i]->getValue());
+            if (leaves[i] != HCNode::NONE)
+                out.writeByte(this->nodes[leaves[i]].symbol);
         }
 
         //cycle through leaves and write the non-null frequencies to the output file
         for (int i = 0; i < 256; i++)
         {
-            if (leaves[i] != nullptr)
-                out.writeLong(leaves[i]->getCount());
+            if (leaves[i] != HCNode::NONE)
+                out.writeLong(this->weights[leaves[i]]);
         }
+    }
+}
 
-        //now need to write the huffman code translation of the input file to the output file
-        BitInputStream in(rStream);
+/** Write the magic number and the given format version that start
+ *  newer compressed files.
+ */
+void HCTree::writeFormat(BitOutputStream& out, int format)
+{
+    out.writeByte(FORMAT_MAGIC >> 16);
+    out.writeByte(FORMAT_MAGIC >> 8);
+    out.writeByte(FORMAT_MAGIC);
+    out.writeByte(format);
+}
 
-        //read in the first byte
-        int i = in.readByte();
+/** Read the magic number and format version at the start of a
+ *  compressed file and return the version. Files without a magic
+ *  number are legacy files, and nothing is read from them.
+ */
+int HCTree::readFormat(BitInputStream& in)
+{
+    //a legacy file has no magic number
+    if (in.peekBits(24) != FORMAT_MAGIC)
+        return FORMAT_LEGACY;
 
-        //while not eof
-        while (i != -1)
+    //skip the magic number and return the version after it
+    in.consumeBits(24);
+    return in.readByte();
+}
+
+/** Write the code lengths of the bytes between the first and the last
+ *  byte that have a code, packed two per byte.
+ *  PRECONDITION: at least one byte has a code, and all code lengths
+ *  are at most MAX_HEADER_CODE_LENGTH.
+ */
+void HCTree::writeCodeLengths(BitOutputStream& out) const
+{
+    //find the range of bytes that have a code
+    int first = 0, last = 255;
+    while (this->codeTable[first].length == 0)
+        first++;
+    while (this->codeTable[last].length == 0)
+        last--;
+    out.writeByte(first);
+    out.writeByte(last);
+
+    //write the code lengths in the range, 4 bits each
+    for (int i = first; i <= last; i++)
+        out.writeBits(this->codeTable[i].length, 4);
+
+    //pad an odd number of lengths to a whole byte
+    if ((last - first) % 2 == 0)
+        out.writeBits(0, 4);
+}
+
+/** Read the code lengths written by writeCodeLengths.
+ *  POSTCONDITION: maxCodeLength and the code lengths in codeTable are set.
+ */
+void HCTree::readCodeLengths(BitInputStream& in)
+{
+    //start over with no codes
+    for (int i = 0; i < 256; i++)
+        this->codeTable[i].length = 0;
+    this->maxCodeLength = 0;
+
+    //read the range of bytes that have a code
+    int first = in.readByte();
+    int last = in.readByte();
+
+    //a truncated header has no codes
+    if (first < 0 || last < first)
+        return;
+
+    //read the code lengths in the range, 4 bits each
+    for (int i = first; i <= last; i++)
+    {
+        this->codeTable[i].length = in.readBits(4);
+        this->maxCodeLength = std::max(this->maxCodeLength, this->codeTable[i].length);
+    }
+
+    //skip the padding of an odd number of lengths
+    if ((last - first) % 2 == 0)
+        in.readBits(4);
+}
+
+/** Replace the code lengths in codeTable by optimal code lengths of at
+ *  most codeLengthLimit bits, using the package-merge algorithm.
+ *  A limit above MAX_HEADER_CODE_LENGTH is lowered to it, as limited
+ *  codes can only be written with the canonical header.
+ *  Every level of the algorithm merges the bytes, sorted by frequency,
+ *  with packages of pairs of items from the level below; the first
+ *  2n-2 items of the top level then tell how often each byte is used.
+ *  PRECONDITION: freqs[i] is the frequency of byte i, at least two
+ *  bytes have a positive frequency.
+ *  POSTCONDITION: codeTable[i].length is the limited code length of
+ *  byte i and maxCodeLength is at most codeLengthLimit.
+ */
+void HCTree::limitCodeLengths(const std::vector<long>& freqs)
+{
+    //an item of a level: its weight, and the byte for a leaf or -1 for a package
+    struct Item {
+        long weight;
+        int symbol;
+    };
+
+    //collect the bytes in the message, sorted by frequency
+    //and then by value to break ties deterministically
+    std::vector<Item> leafItems;
+    for (int i = 0; i < 256; i++)
+    {
+        if (freqs[i] != 0)
+            leafItems.push_back(Item{ freqs[i], i });
+    }
+    std::stable_sort(leafItems.begin(), leafItems.end(), [](const Item& a, const Item& b)
+    {
+        return a.weight < b.weight;
+    });
+    int n = leafItems.size();
+
+    //limited codes only fit the canonical header, and
+    //n codes need at least ceil(log2(n)) bits
+    int limit = std::min(this->codeLengthLimit, (int)MAX_HEADER_CODE_LENGTH);
+    while ((1 << limit) < n)
+        limit++;
+
+    //build the levels from the longest codes up: level 0 holds just the
+    //bytes, every other level merges them with the packages of the level below
+    std::vector<std::vector<Item> > levels(limit);
+    levels[0] = leafItems;
+    for (int j = 1; j < limit; j++)
+    {
+        const std::vector<Item>& below = levels[j - 1];
+        std::vector<Item>& level = levels[j];
+        level.reserve(n + below.size() / 2);
+
+        //merge the bytes with the packages, bytes first on equal weights
+        size_t leaf = 0, pair = 0;
+        while (leaf < leafItems.size() || pair + 1 < below.size())
         {
-            //convert the int to a byte
-            byte b = i;
+            bool havePackage = pair + 1 < below.size();
+            long packageWeight = havePackage ? below[pair].weight + below[pair + 1].weight : 0;
 
-            //write the compressed verion of the current byte to the output file
-            encode(b,out);
+            if (leaf < leafItems.size() && (!havePackage || leafItems[leaf].weight <= packageWeight))
+                level.push_back(leafItems[leaf++]);
+            else
+            {
+                level.push_back(Item{ packageWeight, -1 });
+                pair += 2;
+            }
+        }
+    }
 
-            //read in the next byte
-            i = in.readByte();
+    //start over with all code lengths at 0
+    for (int i = 0; i < 256; i++)
+        this->codeTable[i].length = 0;
+
+    //take the first 2n-2 items of the top level; every byte among the
+    //taken items gets one more bit, every package takes two items of
+    //the level below
+    int taken = 2 * n - 2;
+    for (int j = limit - 1; j >= 0 && taken > 0; j--)
+    {
+        int packages = 0;
+        for (int k = 0; k < taken; k++)
+        {
+            const Item& item = levels[j][k];
+            if (item.symbol >= 0)
+                this->codeTable[item.symbol].length++;
+            else
+                packages++;
         }
+        taken = 2 * packages;
+    }
 
-        //flush the output buffer one last time to write any remaining bits to the output file
-        out.flush();
+    //find the new longest code
+    this->maxCodeLength = 0;
+    for (int i = 0; i < 256; i++)
+        this->maxCodeLength = std::max(this->maxCodeLength, this->codeTable[i].length);
+}
+
+/** Switch to canonical codes for the current code lengths.
+ *  A lone byte at the root has no code bits, so it gets a 1 bit code
+ *  first, to still show up in the code lengths.
+ *  PRECONDITION: build has been called.
+ */
+void HCTree::useCanonicalCodes()
+{
+    for (int i = 0; i < 256; i++)
+    {
+        if (leaves[i] != HCNode::NONE && this->codeTable[i].length == 0)
+            this->codeTable[i].length = 1;
+    }
+
+    this->assignCanonicalCodes();
+}
+
+/** Compress the n bytes at src as one block of the blocked format:
+ *  the code lengths of a code built for just these bytes, followed by
+ *  the coded bytes. With BLOCK_STREAMS streams, the bytes are cut
+ *  into that many parts coded as separate streams, each padded to a
+ *  whole byte, after a jump table with the byte size of each stream.
+ *  PRECONDITION: n > 0, streams is 1 or BLOCK_STREAMS, and
+ *  codeLengthLimit is between 1 and MAX_HEADER_CODE_LENGTH.
+ */
+void HCTree::compressBlock(const byte* src, size_t n, BitOutputStream& out, int streams)
+{
+    //count the bytes of the block, part by part with several streams,
+    //so the size of every stream is known before it is coded
+    double start = this->stats ? Stats::now() : 0;
+    size_t part = (n + BLOCK_STREAMS - 1) / BLOCK_STREAMS;
+    std::vector<long> freqs(256);
+    std::vector<long> partFreqs[BLOCK_STREAMS];
+    if (streams == 1)
+        charCount(freqs, src, n);
+    else
+    {
+        for (int k = 0; k < BLOCK_STREAMS; k++)
+        {
+            size_t begin = std::min(n, k * part);
+            partFreqs[k].resize(256);
+            charCount(partFreqs[k], src + begin, std::min(n, begin + part) - begin);
+            for (int i = 0; i < 256; i++)
+                freqs[i] += partFreqs[k][i];
+        }
+    }
+    this->addTime(Stats::COUNT, start);
+
+    //build the code for the block and write its code lengths
+    start = this->stats ? Stats::now() : 0;
+    this->buildTree(freqs);
+    this->useCanonicalCodes();
+    this->writeCodeLengths(out);
+    this->addTime(Stats::BUILD, start);
+    this->recordCode(&freqs[0]);
+
+    //a single stream follows the code lengths directly
+    start = this->stats ? Stats::now() : 0;
+    if (streams == 1)
+    {
+        //a single repeated byte is fully described by the code lengths
+        if (this->leafCount() > 1)
+        {
+            for (size_t i = 0; i < n; i++)
+                this->encode(src[i], out);
+        }
+        this->addTime(Stats::CODE, start);
+        return;
+    }
+
+    //write the jump table, the byte size of every stream from the
+    //code lengths of the bytes of its part
+    bool coded = this->leafCount() > 1;
+    for (int k = 0; k < BLOCK_STREAMS; k++)
+    {
+        uint64_t bits = 0;
+        for (int i = 0; coded && i < 256; i++)
+            bits += (uint64_t)partFreqs[k][i] * this->codeTable[i].length;
+        out.writeVarint((bits + 7) / 8);
+    }
+
+    //then code the parts straight into out, every stream padded to a whole byte
+    for (int k = 0; k < BLOCK_STREAMS && coded; k++)
+    {
+        size_t begin = std::min(n, k * part);
+        size_t end = std::min(n, begin + part);
+        for (size_t i = begin; i < end; i++)
+            this->encode(src[i], out);
+        out.padToByte();
+    }
+    this->addTime(Stats::CODE, start);
+}
+
+/** Decompress a block written by compressBlock into the n bytes at dst.
+ *  PRECONDITION: in is at the start of the block, n is the number
+ *  of bytes the block holds and streams is what it was written with.
+ */
+void HCTree::decompressBlock(BitInputStream& in, byte* dst, size_t n, int streams)
+{
+    //rebuild the code of the block from its code lengths
+    double start = this->stats ? Stats::now() : 0;
+    this->totalBytes = n;
+    this->readCodeLengths(in);
+    this->assignCanonicalCodes();
+    this->buildDecodeTable();
+    this->addTime(Stats::BUILD, start);
+
+    //decode the bytes of a single stream block
+    start = this->stats ? Stats::now() : 0;
+    if (streams == 1)
+    {
+        for (size_t i = 0; i < n; i++)
+            dst[i] = this->tableLookup(in);
+    }
+    else
+    {
+        //read the jump table and copy out every stream, a stream can't
+        //take more than the longest code for every byte of its part
+        size_t part = (n + BLOCK_STREAMS - 1) / BLOCK_STREAMS;
+        long most = (long)((part * MAX_HEADER_CODE_LENGTH + 7) / 8);
+        std::vector<char> coded[BLOCK_STREAMS];
+        for (int k = 0; k < BLOCK_STREAMS; k++)
+            coded[k].resize(std::min(std::max(in.readVarint(), 0L), most));
+        for (int k = 0; k < BLOCK_STREAMS; k++)
+            in.readBytes(coded[k].data(), coded[k].size());
+
+        //decode the streams side by side
+        BitInputStream s0(coded[0].data(), coded[0].size());
+        BitInputStream s1(coded[1].data(), coded[1].size());
+        BitInputStream s2(coded[2].data(), coded[2].size());
+        BitInputStream s3(coded[3].data(), coded[3].size());
+        this->decodeStreams(s0, s1, s2, s3, dst, n);
+    }
+    this->addTime(Stats::CODE, start);
+
+    //the counts of the block are only needed for the stats
+    if (this->stats != nullptr)
+    {
+        std::vector<long> counts(256);
+        charCount(counts, dst, n);
+        this->recordCode(&counts[0]);
+    }
+}
+
+/** Decode the BLOCK_STREAMS streams of a block into the n bytes at
+ *  dst, a symbol from every stream per step, so the decoding chains
+ *  of the streams can overlap.
+ *  PRECONDITION: the decode table is ready and s0 to s3 read the
+ *  streams in order.
+ */
+void HCTree::decodeStreams(BitInputStream& s0, BitInputStream& s1, BitInputStream& s2,
+                           BitInputStream& s3, byte* dst, size_t n) const
+{
+    //the parts the streams decode to, the last ones may be shorter
+    size_t part = (n + BLOCK_STREAMS - 1) / BLOCK_STREAMS;
+    byte* d0 = dst;
+    byte* d1 = dst + std::min(n, part);
+    byte* d2 = dst + std::min(n, 2 * part);
+    byte* d3 = dst + std::min(n, 3 * part);
+    byte* end = dst + n;
+
+    //while every stream has bytes left, decode one from each
+    size_t i = 0;
+    size_t shortest = end - d3;
+    for (; i < shortest; i++)
+    {
+        //look all four up before storing any, as the byte stores
+        //could otherwise alias the stream state
+        int b0 = this->tableLookup(s0);
+        int b1 = this->tableLookup(s1);
+        int b2 = this->tableLookup(s2);
+        int b3 = this->tableLookup(s3);
+        d0[i] = b0;
+        d1[i] = b1;
+        d2[i] = b2;
+        d3[i] = b3;
+    }
+
+    //then finish the streams that are longer than the last one
+    for (; i < part; i++)
+    {
+        if (d0 + i < d1)
+            d0[i] = this->tableLookup(s0);
+        if (d1 + i < d2)
+            d1[i] = this->tableLookup(s1);
+        if (d2 + i < d3)
+            d2[i] = this->tableLookup(s2);
+    }
+}
+
+/** Assign canonical codes to the bytes from their code lengths:
+ *  shorter codes come first, and codes of the same length are
+ *  consecutive numbers in byte order.
+ *  PRECONDITION: codeTable holds valid code lengths.
+ *  POSTCONDITION: codeTable holds the canonical code of each byte.
+ */
+void HCTree::assignCanonicalCodes()
+{
+    //count the number of codes of each length
+    int lengthCount[65] = { 0 };
+    for (int i = 0; i < 256; i++)
+        lengthCount[this->codeTable[i].length]++;
+    lengthCount[0] = 0;
+
+    //the first code of each length follows the last code of the
+    //previous length, extended by one bit
+    uint64_t nextCode[65];
+    uint64_t code = 0;
+    for (int len = 1; len <= 64; len++)
+    {
+        code = (code + lengthCount[len - 1]) << 1;
+        nextCode[len] = code;
+    }
+
+    //hand out the codes in byte order
+    for (int i = 0; i < 256; i++)
+    {
+        CodeEntry& c = this->codeTable[i];
+        if (c.length > 0)
+            c.bits = nextCode[c.length]++;
     }
 }
 
@@ -238,25 +873,22 @@ void HCTree::compress(std::ostream& wStream, std::istream& rStream)
  *  PRECONDITION: build has been ran to create a Huffman tree.
  *  POSTCONDITION: the output file specified in the 2nd input
  *  argument contains the data of the original file whose
- *  compression information was contained in the input file
+ *  compression information was contained in the input file.
+ *  in must be the stream build2 read the header from.
  */
-void HCTree::decompress(std::ostream& wStream, std::istream& rStream)
+void HCTree::decompress(std::ostream& wStream, BitInputStream& in)
 {
     //variable to hold total number of bytes in original uncompressed file
-    long totalBytes = 0;
+    long totalBytes = this->totalBytes;
 
-    //cycle through leaves to determine number of bytes in input file
-    for (int i = 0; i < 256; i++)
-    {
-        if (leaves[i] != nullptr)
-            totalBytes += leaves[i]->getCount();
-    }
+    //the count of every byte decoded, for the stats
+    long counts[256] = { 0 };
+    double start = this->stats ? Stats::now() : 0;
 
     //if the uncompressed input file wasn't empty, write uncompressed code to output file
     if (totalBytes != 0)
     {
-        //create streams for the input file and the output file
-        BitInputStream in(rStream);
+        //create a stream for the output file
         BitOutputStream out(wStream);
 
         //while there are still bytes to be decoded/written
@@ -264,11 +896,151 @@ void HCTree::decompress(std::ostream& wStream, std::istream& rStream)
         {
             //decode the next byte from the input stream and
             //write it to the output file
-            out.writeByte(this->decode(in));
+            int b = this->decode(in);
+            out.writeByte(b);
+            counts[b]++;
 
             //decrement the totalBytes remaining
             totalBytes--;
         }
+
+        //write the buffered output to the output file
+        out.flush();
+    }
+
+    this->addTime(Stats::CODE, start);
+    this->recordCode(counts);
+}
+
+/** Decode the message into the cap bytes at dst.
+ *  PRECONDITION: build2 has read the header from in.
+ *  Return false, without decoding anything, if the message is larger
+ *  than cap bytes.
+ */
+bool HCTree::decompress(BitInputStream& in, byte* dst, size_t cap)
+{
+    if ((size_t)this->totalBytes > cap)
+        return false;
+
+    //decode every byte straight into the destination
+    double start = this->stats ? Stats::now() : 0;
+    for (long i = 0; i < this->totalBytes; i++)
+        dst[i] = this->decode(in);
+    this->addTime(Stats::CODE, start);
+
+    //the counts of the message are only needed for the stats
+    if (this->stats != nullptr)
+    {
+        std::vector<long> counts(256);
+        charCount(counts, dst, this->totalBytes);
+        this->recordCode(&counts[0]);
+    }
+
+    return true;
+}
+
+/** Return the number of bytes of the message
+ */
+long HCTree::messageSize() const
+{
+    return this->totalBytes;
+}
+
+/** Build a code to share between messages from the counts of a sample
+ *  of them, giving every byte a code.
+ */
+void HCTree::train(const std::vector<long>& freqs)
+{
+    //the bytes the sample lacks get the smallest count, so they end up
+    //with the longest codes, and the other bytes barely notice them
+    std::vector<long> counts(freqs);
+    for (int i = 0; i < 256; i++)
+        counts[i] = std::max(counts[i], 1L);
+
+    //the code lengths have to fit the table file
+    if (this->codeLengthLimit < 1 || this->codeLengthLimit > MAX_HEADER_CODE_LENGTH)
+        this->codeLengthLimit = MAX_HEADER_CODE_LENGTH;
+    this->buildTree(counts);
+    this->useCanonicalCodes();
+    this->buildDecodeTable();
+}
+
+/** Write the code as a table file: the magic number, the format
+ *  version and the code lengths of all 256 bytes.
+ */
+void HCTree::writeTable(BitOutputStream& out) const
+{
+    writeFormat(out, FORMAT_TABLE);
+    this->writeCodeLengths(out);
+    out.flush();
+}
+
+/** Load the code of a table file written by writeTable.
+ *  Return false if in isn't a table file, or the table is damaged.
+ */
+bool HCTree::readTable(BitInputStream& in)
+{
+    if (readFormat(in) != FORMAT_TABLE)
+        return false;
+    this->reset();
+    this->readCodeLengths(in);
+
+    //every byte needs a code, and the codes have to be a complete
+    //prefix code for the decode table
+    long kraft = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        if (this->codeTable[i].length == 0)
+            return false;
+        kraft += 1L << (MAX_HEADER_CODE_LENGTH - this->codeTable[i].length);
+    }
+    if (kraft != 1L << MAX_HEADER_CODE_LENGTH)
+        return false;
+
+    this->assignCanonicalCodes();
+    this->buildDecodeTable();
+    return true;
+}
+
+/** Return the number that tells tables apart, the CRC32C of the code
+ *  lengths of all 256 bytes
+ */
+uint32_t HCTree::tableId() const
+{
+    byte lengths[256];
+    for (int i = 0; i < 256; i++)
+        lengths[i] = this->codeTable[i].length;
+    return Crc32c::compute(lengths, 256);
+}
+
+/** Compress the n bytes at src into out with the loaded table, and
+ *  flush it, writing the id of the table and the number of bytes in
+ *  place of a code header.
+ */
+void HCTree::compressShared(BitOutputStream& out, const byte* src, size_t n)
+{
+    //write the short header
+    double start = this->stats ? Stats::now() : 0;
+    writeFormat(out, FORMAT_SHARED);
+    uint32_t id = this->tableId();
+    for (int k = 0; k < 4; k++)
+        out.writeByte(id >> (8 * k));
+    out.writeVarint(n);
+    this->totalBytes = n;
+
+    //code the bytes straight away, there is nothing to count
+    for (size_t i = 0; i < n; i++)
+        this->encode(src[i], out);
+    out.flush();
+    this->addTime(Stats::CODE, start);
+
+    //the counts of the message are only needed for the stats
+    if (this->stats != nullptr)
+    {
+        std::vector<long> counts(256);
+        charCount(counts, src, n);
+        this->recordCode(&counts[0]);
+        this->stats->codedBytes += out.bytesWritten();
     }
 }
 
@@ -279,11 +1051,46 @@ void HCTree::decompress(std::ostream& wStream, std::istream& rStream)
  */
 void HCTree::encode(byte symbol, BitOutputStream& out) const
 {
-    //create a temporary pointer to the current symbol
-    HCNode* const ptr = leaves[symbol];
+    //look up the code of the current symbol
+    const CodeEntry& code = this->codeTable[symbol];
 
-    //write the Huffman code to the output file
-    leafToRoot(ptr, out);
+    //write the whole Huffman code to the output file at once,
+    //codes longer than 64 bits have to be written by walking the tree
+    if (code.length <= 64)
+        out.writeBits(code.bits, code.length);
+    else
+        leafToRoot(leaves[symbol], out);
+}
+
+/** Build the table of codes used by encode from the Huffman tree.
+ *  PRECONDITION: root points to the root of the trie, and leaves[i]
+ *  points to the leaf node containing byte i.
+ *  POSTCONDITION: codeTable[i] holds the code of byte i.
+ */
+void HCTree::buildCodeTable()
+{
+    this->maxCodeLength = 0;
+
+    for (int i = 0; i < 256; i++)
+    {
+        CodeEntry& code = this->codeTable[i];
+        code.bits = 0;
+        code.length = 0;
+
+        //walk from the leaf up to the root, collecting the code
+        //from its last bit to its first
+        for (int node = this->leaves[i]; node != HCNode::NONE && node != this->root; node = this->nodes[node].p)
+        {
+            //add the bit type of the current node in front of the bits so far
+            //(1 is it is a 1 child otherwise 0)
+            if (this->nodes[this->nodes[node].p].c1 == node && code.length < 64)
+                code.bits |= 1ULL << code.length;
+            code.length++;
+        }
+
+        //keep track of the longest code
+        this->maxCodeLength = std::max(this->maxCodeLength, code.length);
+    }
 }
 
 /** Return symbol coded in the next sequence of bits from the stream.
@@ -293,25 +1100,149 @@ void HCTree::encode(byte symbol, BitOutputStream& out) const
 int HCTree::decode(BitInputStream& in) const
 {
     //call helper function to find the symbol
-    //encoded by the current place in the bit stream
-    return rootToLeaf(in);
+    //encoded by the current place in the bit stream,
+    //codes longer than 64 bits have to be found by walking the tree
+    if (this->maxCodeLength > 64)
+        return rootToLeaf(in);
+    return tableLookup(in);
+}
+
+/** Build the lookup tables used by decode from the codes in codeTable.
+ *  PRECONDITION: codeTable holds a prefix code of at most 64 bits,
+ *  or root is a lone leaf.
+ *  POSTCONDITION: decodeTable resolves every code in codeTable.
+ *  A lone byte decodes without reading any bits.
+ */
+void HCTree::buildDecodeTable()
+{
+    //codes longer than 64 bits are decoded by walking the tree
+    if (this->maxCodeLength > 64)
+        return;
+
+    //collect the bytes that have a code
+    int syms[256];
+    int n = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        if (this->codeTable[i].length > 0)
+            syms[n++] = i;
+    }
+
+    //sort them by their code, first bit first, so that codes
+    //sharing a prefix end up next to each other
+    const CodeEntry* codes = this->codeTable;
+    std::sort(syms, syms + n, [codes](int a, int b)
+    {
+        return (codes[a].bits << (64 - codes[a].length)) <
+               (codes[b].bits << (64 - codes[b].length));
+    });
+
+    //the primary table is as wide as the longest code, up to DECODE_BITS,
+    //and at least 1 bit so a lone root leaf still has a table to fill
+    this->decodeBits = std::min(this->maxCodeLength, (int)DECODE_BITS);
+    if (this->decodeBits < 1)
+        this->decodeBits = 1;
+
+    //start with an empty primary table, subtables get appended behind it
+    this->decodeTable.assign(1 << this->decodeBits, DecodeEntry());
+
+    //a single byte (or a lone leaf at the root) is all there is to
+    //decode, so it takes no bits at all
+    if (n <= 1)
+    {
+        DecodeEntry e;
+        e.value = (n == 1) ? syms[0] : (this->root != HCNode::NONE ? this->nodes[this->root].symbol : 0);
+        e.bits = 0;
+        e.link = 0;
+        this->decodeTable.assign(1 << this->decodeBits, e);
+    }
+    else
+        fillDecodeTable(syms, n, 0, this->decodeBits, 0);
+}
+
+/** Fill the decode table level starting at base and indexed by
+ *  tableBits bits with the codes of the n bytes in syms, whose first
+ *  shift bits have been used by the levels above.
+ *  PRECONDITION: syms is sorted by code.
+ */
+void HCTree::fillDecodeTable(const int* syms, int n, int base, int tableBits, int shift)
+{
+    //mask for the index bits of this level
+    const uint64_t mask = (1ULL << tableBits) - 1;
+
+    int i = 0;
+    while (i < n)
+    {
+        const CodeEntry& code = this->codeTable[syms[i]];
+        int rest = code.length - shift;
+
+        //if the rest of the code fits in this level, every index
+        //starting with it decodes to this byte
+        if (rest <= tableBits)
+        {
+            DecodeEntry e;
+            e.value = syms[i];
+            e.bits = rest;
+            e.link = 0;
+
+            //the remaining index bits don't belong to this code
+            int first = base + (int)((code.bits & ((1ULL << rest) - 1)) << (tableBits - rest));
+            int last = first + (1 << (tableBits - rest));
+            for (int k = first; k < last; k++)
+                this->decodeTable[k] = e;
+            i++;
+        }
+        else
+        {
+            //the code continues past this level: find the run of
+            //codes sharing its index bits at this level
+            uint64_t index = (code.bits >> (rest - tableBits)) & mask;
+            int maxRest = rest;
+            int j = i + 1;
+            while (j < n)
+            {
+                const CodeEntry& next = this->codeTable[syms[j]];
+                int nextRest = next.length - shift;
+                if (nextRest <= tableBits || ((next.bits >> (nextRest - tableBits)) & mask) != index)
+                    break;
+                maxRest = std::max(maxRest, nextRest);
+                j++;
+            }
+
+            //the subtable is as wide as the rest of the longest of them
+            int subBits = std::min(maxRest - tableBits, (int)DECODE_BITS);
+            int subBase = this->decodeTable.size();
+            this->decodeTable.resize(subBase + (1 << subBits), DecodeEntry());
+
+            //point the current entry at the subtable
+            DecodeEntry& e = this->decodeTable[base + index];
+            e.value = subBase;
+            e.bits = subBits;
+            e.link = 1;
+
+            //fill the subtable with the rest of the run's codes
+            fillDecodeTable(syms + i, j - i, subBase, subBits, shift + tableBits);
+            i = j;
+        }
+    }
 }
 
 /** Recursive function to cycle through the Huffman tree
  *  leaf to root and write huffman code to file in root to leaf order
  */
-void HCTree::leafToRoot(HCNode* const ptr, BitOutputStream& out) const
+void HCTree::leafToRoot(int node, BitOutputStream& out) const
 {
     //if we are at the root return to the caller
-    if(ptr == this->root)
+    if(node == this->root)
        return;
 
     //otherwise, continue to the parent node
-    leafToRoot(ptr->getP(), out);
+    int parent = this->nodes[node].p;
+    leafToRoot(parent, out);
 
     //write the bit type of the current node
     //(1 is it is a 1 child otherwise 0)
-    out.writeBit(ptr->getP()->getC1() == ptr);
+    out.writeBit(this->nodes[parent].c1 == node);
 }
 
 /** Function to cycle through the Huffman tree from root to leaf
@@ -319,31 +1250,31 @@ void HCTree::leafToRoot(HCNode* const ptr, BitOutputStream& out) const
  */
 int HCTree::rootToLeaf(BitInputStream& in) const
 {
-    //create a temporary pointer pointing to the root of the huffman tree
-    HCNode* ptr = this->root;
+    //start at the root of the huffman tree
+    const HCNode* node = &this->nodes[this->root];
 
     //obtain the first bit to determine which child to go to
     int i = in.readBit();
 
     //travel to the first correct child node
     if (i == 1)
-        ptr = ptr->getC1();
+        node = &this->nodes[node->c1];
     else
-        ptr = ptr->getC0();
+        node = &this->nodes[node->c0];
 
     //while we aren't at a leaf node
-    while (ptr->getC0() != nullptr && ptr->getC1() != nullptr)
+    while (node->c0 != HCNode::NONE && node->c1 != HCNode::NONE)
     {
         //determine the next bit falue
         i = in.readBit();
 
          //travel to the next correct child node
         if (i == 1)
-            ptr = ptr->getC1();
+            node = &this->nodes[node->c1];
         else
-            ptr = ptr->getC0();
+            node = &this->nodes[node->c0];
     }
-    int j = ptr->getValue();
+    int j = node->symbol;
 
     //return the value of the leaf node
     return j;
@@ -352,18 +1283,19 @@ int HCTree::rootToLeaf(BitInputStream& in) const
 /** Recursive function to cycle through the Huffman tree
  *  leaf to root and output huffman code in root to leaf order
  */
-void HCTree::traverseToScreen(HCNode* const ptr) const
+void HCTree::traverseToScreen(int node) const
 {
     //if we are at the root return to the caller
-    if(ptr == this->root)
+    if(node == this->root)
        return;
 
     //otherwise, continue to the parent node
-    traverseToScreen(ptr->getP());
+    int parent = this->nodes[node].p;
+    traverseToScreen(parent);
 
     //write the bit type of the current node
     //(1 is it is a 1 child otherwise 0)
-    std::cout << (ptr->getP()->getC1() == ptr);
+    std::cout << (this->nodes[parent].c1 == node);
 }
 
 /** Populate the freqs vector with the frequency of each
@@ -374,16 +1306,151 @@ void HCTree::traverseToScreen(HCNode* const ptr) const
  */
 void HCTree::charCount(std::vector<long>& freqs, BitInputStream& in)
 {
-    //read in the first byte
-    int i = in.readByte();
+    //count the stream a buffer at a time
+    std::vector<char> buf(BitInputStream::BLOCK_SIZE);
+    size_t n;
+    while ((n = in.readBytes(&buf[0], buf.size())) > 0)
+        charCount(freqs, reinterpret_cast<const byte*>(&buf[0]), n);
+}
+
+/** Number of sub-histograms the byte counting kernels spread bytes over
+ */
+static const int COUNT_WAYS = 4;
+
+/** Most bytes counted into the sub-histograms before they are added to
+ *  freqs, so their 32-bit counters can't overflow
+ */
+static const size_t COUNT_CHUNK = (size_t)1 << 30;
 
-    //while not eof
-    while (i != -1)
+/** Count the n bytes at src into the sub-histograms.
+ *  Neighbouring bytes go to different sub-histograms, so a run of equal
+ *  bytes doesn't make every increment wait for the one before it.
+ */
+static inline void countBytes(uint32_t counts[COUNT_WAYS][256], const byte* src, size_t n)
+{
+    size_t i = 0;
+
+    //eight bytes per load, two into each sub-histogram
+    for (; i + 8 <= n; i += 8)
     {
-        //increment the count
-        freqs[i]++;
-        //read in the next byte
-        i = in.readByte();
+        uint64_t w;
+        memcpy(&w, src + i, 8);
+        counts[0][w & 255]++;
+        counts[1][(w >> 8) & 255]++;
+        counts[2][(w >> 16) & 255]++;
+        counts[3][(w >> 24) & 255]++;
+        counts[0][(w >> 32) & 255]++;
+        counts[1][(w >> 40) & 255]++;
+        counts[2][(w >> 48) & 255]++;
+        counts[3][w >> 56]++;
+    }
+
+    //then the bytes left over
+    for (; i < n; i++)
+        counts[0][src[i]]++;
+}
+
+#ifdef HCTREE_COUNT_AVX2
+/** Count the n bytes at src into the sub-histograms, 32 bytes at a time.
+ *  32 copies of the same byte, as in runs of zeros, are counted with a
+ *  single add, and anything else goes through countBytes.
+ *  PRECONDITION: the cpu supports AVX2.
+ */
+__attribute__((target("avx2")))
+static void countBytesAvx2(uint32_t counts[COUNT_WAYS][256], const byte* src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        //compare the 32 bytes with the first of them
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i first = _mm256_set1_epi8(src[i]);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, first)) == -1)
+            counts[0][src[i]] += 32;
+        else
+            countBytes(counts, src + i, 32);
+    }
+
+    //then the bytes left over
+    countBytes(counts, src + i, n - i);
+}
+#endif
+
+/** Add the frequency of each byte value among the n bytes at src
+ *  to the freqs vector
+ *  POSTCONDITION: freqs[i] is increased by the count of byte i
+ */
+void HCTree::charCount(std::vector<long>& freqs, const byte* src, size_t n)
+{
+#ifdef HCTREE_COUNT_AVX2
+    //use the AVX2 kernel if the cpu has it
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    while (n > 0)
+    {
+        //count a chunk into the sub-histograms
+        uint32_t counts[COUNT_WAYS][256] = { { 0 } };
+        size_t take = std::min(n, COUNT_CHUNK);
+#ifdef HCTREE_COUNT_AVX2
+        if (avx2)
+            countBytesAvx2(counts, src, take);
+        else
+#endif
+            countBytes(counts, src, take);
+
+        //add the sub-histograms into freqs
+        for (int b = 0; b < 256; b++)
+        {
+            long sum = 0;
+            for (int k = 0; k < COUNT_WAYS; k++)
+                sum += counts[k][b];
+            freqs[b] += sum;
+        }
+
+        src += take;
+        n -= take;
+    }
+}
+
+/** Add the frequency of each byte value among the n bytes at src
+ *  to the freqs vector, counting on the given number of threads
+ *  (below 1 for one per hardware thread). Every thread counts its own
+ *  chunk into its own histogram, and the histograms are added up at
+ *  the end.
+ *  POSTCONDITION: freqs[i] is increased by the count of byte i
+ */
+void HCTree::charCount(std::vector<long>& freqs, const byte* src, size_t n, int threads)
+{
+    //small inputs aren't worth starting threads for
+    if (threads == 1 || n < PARALLEL_COUNT_MIN)
+    {
+        charCount(freqs, src, n);
+        return;
+    }
+
+    //cut the bytes into one chunk per thread
+    ThreadPool pool(threads);
+    size_t chunks = pool.size();
+    size_t chunk = (n + chunks - 1) / chunks;
+
+    //count every chunk into its own histogram
+    std::vector<std::vector<long> > partial(chunks, std::vector<long>(256));
+    std::vector<std::future<void> > done;
+    for (size_t k = 0; k * chunk < n; k++)
+    {
+        const byte* begin = src + k * chunk;
+        size_t take = std::min(chunk, n - k * chunk);
+        std::vector<long>& counts = partial[k];
+        done.push_back(pool.submit([&counts, begin, take]() { charCount(counts, begin, take); }));
+    }
+
+    //add the histograms up in chunk order
+    for (size_t k = 0; k < done.size(); k++)
+    {
+        done[k].get();
+        for (int b = 0; b < 256; b++)
+            freqs[b] += partial[k][b];
     }
 }
 
@@ -422,11 +1489,60 @@ void HCTree::charCount2(std::vector<long>& freqs, BitInputStream& in)
     }
 }
 
-/** Function to set the root to point at an HCNode
+/** Function to set the longest code build may produce, 0 for no limit
  */
-void HCTree::setRoot(HCNode* const root)
+void HCTree::setCodeLengthLimit(int limit)
 {
-    //set the root to the provided pointer value
+    //set the limit to the provided value
+    this->codeLengthLimit = limit;
+}
+
+/** Function to set the stats the time spent in every phase, and the
+ *  counts and code lengths of the bytes coded, are added to.
+ */
+void HCTree::setStats(Stats* stats)
+{
+    this->stats = stats;
+}
+
+/** Add the time since start to the given phase of the stats.
+ */
+void HCTree::addTime(int phase, double start) const
+{
+    if (this->stats != nullptr)
+        this->stats->seconds[phase] += Stats::now() - start;
+}
+
+/** Add the counts of the bytes that were coded, the bits their codes
+ *  took and the longest code to the stats.
+ */
+void HCTree::recordCode(const long* counts) const
+{
+    if (this->stats == nullptr)
+        return;
+
+    //a single repeated byte is coded without any bits
+    int distinct = 0;
+    for (int i = 0; i < 256; i++)
+        distinct += (counts[i] > 0);
+
+    for (int i = 0; i < 256; i++)
+    {
+        this->stats->freqs[i] += counts[i];
+        this->stats->messageBytes += counts[i];
+        if (distinct > 1)
+            this->stats->payloadBits += counts[i] * this->codeTable[i].length;
+    }
+
+    if (distinct > 1)
+        this->stats->maxCodeLength = std::max(this->stats->maxCodeLength, this->maxCodeLength);
+}
+
+/** Function to set the root to the HCNode at the given index
+ */
+void HCTree::setRoot(int root)
+{
+    //set the root to the provided index
     this->root = root;
 }
 
@@ -440,8 +1556,7 @@ int HCTree::leafCount()
     //cycle through leaves to determine number of bytes in input file
     for (int i = 0; i < 256; i++)
     {
-        if (leaves[i] != nullptr)
-            //totalBytes += leaves[i]->getCount();
+        if (leaves[i] != HCNode::NONE)
             uniqueBytes += 1;
     }
 
@@ -449,6 +1564,15 @@ int HCTree::leafCount()
     return uniqueBytes;
 }
 
+/** Function to copy the count of the leaf of each byte to counts[i],
+ *  0 for bytes without a leaf
+ */
+void HCTree::leafCounts(long* counts) const
+{
+    for (int i = 0; i < 256; i++)
+        counts[i] = (this->leaves[i] != HCNode::NONE) ? this->weights[this->leaves[i]] : 0;
+}
+
 /** Function to print byte value, it's count and it's Huffman code for debugging
  */
 void HCTree::printHuffman(std::vector<long>& freqs)
@@ -456,9 +1580,9 @@ void HCTree::printHuffman(std::vector<long>& freqs)
     //debug to output huffman tree
     for (int i = 0; i < 256; i++)
     {
-        if (this->leaves[i] != nullptr)
+        if (this->leaves[i] != HCNode::NONE)
         {
-            std::cout << setw(10) << (long)this->leaves[i]->getValue();
+            std::cout << setw(10) << (long)this->nodes[this->leaves[i]].symbol;
             std::cout << " : " << setw(11) << freqs[i] << " : ";
             this->traverseToScreen(this->leaves[i]);
             std::cout << "\n";
@@ -467,23 +1591,15 @@ void HCTree::printHuffman(std::vector<long>& freqs)
 }
 
 /** Function to delete the entire huffman tree
- *  PRECONDITION: build has been called and a huffman tree exists
- *  POSTCONDITION: all nodes of the tree have been delete and root
- *  points to nothing
+ *  POSTCONDITION: all nodes of the tree have been handed back to the
+ *  arena, and root and leaves are HCNode::NONE
  */
-void HCTree::deleteTree(HCNode* node)
+void HCTree::deleteTree()
 {
-    //if the node isn't already deleted
-    if (node != nullptr)
-    {
-        //delete the 0 child
-        deleteTree(node->getC0());
-        //delete the 1 child
-        deleteTree(node->getC1());
-        //delete the node
-        delete node;
-    }
+    //empty the arena, its nodes are set up again as they are taken
+    this->nodeCount = 0;
 
-    //set the pointer to nothing
-    node = nullptr;
+    //the root and leaves are no nodes
+    this->root = HCNode::NONE;
+    std::fill(this->leaves, this->leaves + 256, HCNode::NONE);
 }
@@ -1,24 +1,29 @@
 #ifndef HCTREE_HPP
 #define HCTREE_HPP
 
-#include <queue>
+#include <algorithm>
 #include <vector>
 #include <iomanip>
 #include "HCNode.hpp"
 #include "BitInputStream.hpp"
 #include "BitOutputStream.hpp"
+#include "Stats.hpp"
 
-/** A 'function class' for use as the Compare class in a
- *  priority_queue<HCNode*>.
- *  For this to work, operator< must be defined to
- *  do the right thing on HCNodes.
+/** An entry of the table-driven decoder.
+ *  The table is indexed by the next bits of the stream. An entry either
+ *  resolves a whole symbol, or links to a subtable for longer codes.
  */
-class HCNodePtrComp {
-public:
-    bool operator()(HCNode*& lhs, HCNode*& rhs) const
-    {
-        return !(*lhs < *rhs);
-    }
+struct DecodeEntry {
+    unsigned int value : 24;  // the symbol, or the subtable offset if link is set
+    unsigned int bits  : 7;   // code bits used at this level, or the subtable width
+    unsigned int link  : 1;   // set if the entry points to a subtable
+};
+
+/** An entry of the encoding table: the code of one symbol.
+ */
+struct CodeEntry {
+    unsigned long long bits;  // the code, first bit in the msb of its length
+    int length;               // the number of bits in the code
 };
 
 /** A Huffman Code Tree class.
@@ -27,53 +32,327 @@ public:
  */
 class HCTree {
 private:
-    HCNode* root;
-    std::vector<HCNode*> leaves;
+    HCNode nodes[511];                     // arena the nodes of the trie are taken from
+    long weights[511];                     // count of every node of the arena
+    int nodeCount;                         // number of nodes taken from the arena
+    uint16_t root;                         // index of the root, HCNode::NONE if the trie is empty
+    uint16_t leaves[256];                  // index of the leaf of each byte, HCNode::NONE if it has none
+    CodeEntry codeTable[256];              // the code of each byte, for encoding
+    std::vector<DecodeEntry> decodeTable;  // primary table followed by subtables
+    int decodeBits;                        // index width of the primary table
+    int maxCodeLength;                     // length of the longest code
+    long totalBytes;                       // number of bytes in the message
+    int codeLengthLimit;                   // longest code build may produce, 0 for no limit
+    Stats* stats;                          // where the time and code statistics go, if anywhere
 
 public:
-    explicit HCTree() : root(0)
+    /** Maximum index width of a decode table level
+     */
+    static const int DECODE_BITS = 11;
+
+    /** Magic number at the start of newer compressed files, followed by
+     *  the format version. Legacy files start with the number of unique
+     *  bytes less one, so 0xFF there means all 256 bytes follow in order,
+     *  starting with 0 rather than 'H'.
+     */
+    static const int FORMAT_MAGIC = 0xFF4843;
+
+    /** Format versions of compressed files
+     */
+    static const int FORMAT_LEGACY = 0;     // frequency header, no magic number
+    static const int FORMAT_CANONICAL = 1;  // canonical codes, code length header
+    static const int FORMAT_BLOCKED = 2;    // blocks with their own code lengths
+    static const int FORMAT_STREAMS = 3;    // blocked, every block coded as 4 streams
+    static const int FORMAT_TABLE = 4;      // a shared code table written by train
+    static const int FORMAT_SHARED = 5;     // coded with a shared table, no code header
+    static const int FORMAT_CONTEXT = 6;    // a code per context of the previous byte
+
+    /** Flag added to the version of a blocked file whose blocks carry
+     *  a CRC32C of their bytes
+     */
+    static const int FORMAT_CHECKSUM = 0x80;
+
+    /** Flag added to the version of a blocked file that ends with an
+     *  index of its blocks, for random access
+     */
+    static const int FORMAT_INDEX = 0x40;
+
+    /** Longest code the 4-bit code lengths of the canonical header can hold
+     */
+    static const int MAX_HEADER_CODE_LENGTH = 15;
+
+    /** Number of streams a block of FORMAT_STREAMS is split into
+     */
+    static const int BLOCK_STREAMS = 4;
+
+    /** Fewest bytes worth counting on more than one thread
+     */
+    static const size_t PARALLEL_COUNT_MIN = 4 * 1024 * 1024;
+
+    explicit HCTree() : nodeCount(0), root(HCNode::NONE), decodeBits(0), maxCodeLength(0), totalBytes(0),
+        codeLengthLimit(MAX_HEADER_CODE_LENGTH), stats(0)
     {
-        leaves = std::vector<HCNode*>(256, (HCNode*) 0);
+        std::fill(leaves, leaves + 256, HCNode::NONE);
+        for (int i = 0; i < 256; i++)
+        {
+            codeTable[i].bits = 0;
+            codeTable[i].length = 0;
+        }
     }
 
     /** default destructor
      */
     ~HCTree();
 
+    /** Forget the code, so the tree can build or read another one.
+     *  The memory of the decode table is kept for the next code, which
+     *  saves allocations when one tree codes many small messages.
+     *  POSTCONDITION: the tree is as constructed, but for the code
+     *  length limit and stats.
+     */
+    void reset();
+
     /** Use the Huffman algorithm to build a Huffman coding trie.
      *  PRECONDITION: freqs is a vector of ints, such that freqs[i] is
      *  the frequency of occurrence of byte i in the message and
      *  s points to an uncompressed file.
      *  POSTCONDITION:  root points to the root of the trie,
      *  and leaves[i] points to the leaf node containing byte i.
+     *  If the trie has codes longer than codeLengthLimit, codeTable holds
+     *  length-limited canonical codes that no longer follow the trie.
      */
     void build(std::vector<long>& freqs, std::istream& rStream);
 
-    /** Use the Huffman algorithm to build a Huffman coding trie.
-     *  PRECONDITION: freqs is a vector of ints, such that freqs[i] is
-     *  the frequency of occurrence of byte i in the message and
-     *  s points to a compressed file
-     *  POSTCONDITION:  root points to the root of the trie,
-     *  and leaves[i] points to the leaf node containing byte i.
-     *  The number of bytes from the original uncompressed file is returned
+    /** Use the Huffman algorithm to build a Huffman coding trie for the
+     *  n bytes at src, read in place, counting them on the given number
+     *  of threads (below 1 for one per hardware thread).
+     *  PRECONDITION: freqs is a vector of 256 zeros.
+     *  POSTCONDITION: as for build.
+     */
+    void build(std::vector<long>& freqs, const byte* src, size_t n, int threads = 1);
+
+    /** Use the Huffman algorithm to build a Huffman coding trie from
+     *  frequencies that have already been counted.
+     *  PRECONDITION: freqs[i] is the frequency of occurrence of byte i
+     *  in the message.
+     *  POSTCONDITION: as for build.
+     */
+    void buildTree(std::vector<long>& freqs);
+
+    /** Build the Huffman trie of the bytes with a positive frequency in the
+     *  node arena. In sorted order, the counts are sorted once and the two
+     *  lightest trees are taken from the front of the sorted leaves or of
+     *  the merged trees, which are made in order of weight. In legacy order,
+     *  the trees are merged in the order of the priority queue of node
+     *  pointers legacy files were written with.
+     *  POSTCONDITION: root is the root of the trie, or HCNode::NONE if
+     *  no byte has a positive frequency, and leaves[i] is the leaf
+     *  node containing byte i.
+     */
+    void buildTrie(const std::vector<long>& freqs, bool legacyOrder);
+
+    /** Take the next node of the arena, set it up as a leaf with the
+     *  given count and byte, and return its index.
      */
-    void build2(std::vector<long>& freqs, std::istream& rStream);
+    int newNode(long count, byte symbol);
+
+    /** Read the header of a compressed file and prepare for decoding it.
+     *  PRECONDITION: freqs is a vector of 256 zeros, in reads a compressed
+     *  file and format is the version readFormat returned for it.
+     *  POSTCONDITION: for a legacy file, freqs[i] is the frequency of
+     *  byte i, root points to the root of the trie and leaves[i] points to
+     *  the leaf node containing byte i. For a canonical file, the code
+     *  lengths are read instead and no trie is built.
+     *  A file coded with a shared table only holds the number of bytes,
+     *  and readTable has to have loaded the table it was coded with.
+     *  Either way the decode table is ready and in is positioned at the
+     *  start of the compressed data.
+     *  Return false if the format has no single code table, or the
+     *  shared table isn't the one loaded.
+     */
+    bool build2(std::vector<long>& freqs, BitInputStream& in, int format);
 
     /** Use the Huffman tree to create the output file.
      *  PRECONDITION: build has been ran to create a Huffman tree.
      *  POSTCONDITION: the output file specified in the 2nd input
      *  argument contains the header and compressed huffman code
-     *  representing the data from the file in the first input argument
+     *  representing the data from the file in the first input argument.
+     *  The canonical format is written whenever the code lengths fit
+     *  its header, the legacy format otherwise.
      */
     void compress(std::ostream& wStream, std::istream& rStream);
 
+    /** Use the Huffman tree to compress the n bytes at src, read in place.
+     *  PRECONDITION: build has been ran on the same bytes.
+     *  POSTCONDITION: as for compress.
+     */
+    void compress(std::ostream& wStream, const byte* src, size_t n);
+
+    /** Use the Huffman tree to compress the n bytes at src, read in place,
+     *  into out, and flush it.
+     *  PRECONDITION: build has been ran on the same bytes.
+     */
+    void compress(BitOutputStream& out, const byte* src, size_t n);
+
+    /** Write the header compress starts the output file with, switching
+     *  to canonical codes if the canonical header is used.
+     *  PRECONDITION: build has been ran to create a Huffman tree.
+     */
+    void writeHeader(BitOutputStream& out);
+
+    /** Write the magic number and the given format version that start
+     *  newer compressed files.
+     */
+    static void writeFormat(BitOutputStream& out, int format);
+
+    /** Read the magic number and format version at the start of a
+     *  compressed file and return the version. Files without a magic
+     *  number are legacy files, and nothing is read from them.
+     */
+    static int readFormat(BitInputStream& in);
+
+    /** Write the code lengths of the bytes between the first and the last
+     *  byte that have a code, packed two per byte.
+     *  PRECONDITION: at least one byte has a code, and all code lengths
+     *  are at most MAX_HEADER_CODE_LENGTH.
+     */
+    void writeCodeLengths(BitOutputStream& out) const;
+
+    /** Read the code lengths written by writeCodeLengths.
+     *  POSTCONDITION: maxCodeLength and the code lengths in codeTable are set.
+     */
+    void readCodeLengths(BitInputStream& in);
+
+    /** Compress the n bytes at src as one block of the blocked format:
+     *  the code lengths of a code built for just these bytes, followed by
+     *  the coded bytes. With BLOCK_STREAMS streams, the bytes are cut
+     *  into that many parts coded as separate streams, each padded to a
+     *  whole byte, after a jump table with the byte size of each stream.
+     *  PRECONDITION: n > 0, streams is 1 or BLOCK_STREAMS, and
+     *  codeLengthLimit is between 1 and MAX_HEADER_CODE_LENGTH.
+     */
+    void compressBlock(const byte* src, size_t n, BitOutputStream& out, int streams = 1);
+
+    /** Decompress a block written by compressBlock into the n bytes at dst.
+     *  PRECONDITION: in is at the start of the block, n is the number
+     *  of bytes the block holds and streams is what it was written with.
+     */
+    void decompressBlock(BitInputStream& in, byte* dst, size_t n, int streams = 1);
+
+    /** Decode the BLOCK_STREAMS streams of a block into the n bytes at
+     *  dst, a symbol from every stream per step, so the decoding chains
+     *  of the streams can overlap.
+     *  PRECONDITION: the decode table is ready and s0 to s3 read the
+     *  streams in order.
+     */
+    void decodeStreams(BitInputStream& s0, BitInputStream& s1, BitInputStream& s2,
+                       BitInputStream& s3, byte* dst, size_t n) const;
+
+    /** Replace the code lengths in codeTable by optimal code lengths of at
+     *  most codeLengthLimit bits, using the package-merge algorithm.
+     *  A limit above MAX_HEADER_CODE_LENGTH is lowered to it, as limited
+     *  codes can only be written with the canonical header.
+     *  PRECONDITION: freqs[i] is the frequency of byte i, at least two
+     *  bytes have a positive frequency.
+     *  POSTCONDITION: codeTable[i].length is the limited code length of
+     *  byte i and maxCodeLength is at most codeLengthLimit.
+     */
+    void limitCodeLengths(const std::vector<long>& freqs);
+
+    /** Function to set the stats the time spent in every phase, and the
+     *  counts and code lengths of the bytes coded, are added to.
+     *  Null (the default) keeps no stats.
+     */
+    void setStats(Stats* stats);
+
+    /** Add the time since start to the given phase of the stats.
+     */
+    void addTime(int phase, double start) const;
+
+    /** Add the counts of the bytes that were coded, the bits their codes
+     *  took and the longest code to the stats.
+     *  PRECONDITION: codeTable holds the codes the bytes were coded with.
+     */
+    void recordCode(const long* counts) const;
+
+    /** Function to set the longest code build may produce, 0 for no limit.
+     *  Limits below what the number of distinct bytes needs are raised.
+     */
+    void setCodeLengthLimit(int limit);
+
+    /** Switch to canonical codes for the current code lengths.
+     *  A lone byte at the root has no code bits, so it gets a 1 bit code
+     *  first, to still show up in the code lengths.
+     *  PRECONDITION: build has been called.
+     */
+    void useCanonicalCodes();
+
+    /** Assign canonical codes to the bytes from their code lengths:
+     *  shorter codes come first, and codes of the same length are
+     *  consecutive numbers in byte order.
+     *  PRECONDITION: codeTable holds valid code lengths.
+     *  POSTCONDITION: codeTable holds the canonical code of each byte.
+     */
+    void assignCanonicalCodes();
+
     /** Use the Huffman tree to create the output file.
      *  PRECONDITION: build has been ran to create a Huffman tree.
      *  POSTCONDITION: the output file specified in the 2nd input
      *  argument contains the data of the original file whose
-     *  compression information was contained in the input file
+     *  compression information was contained in the input file.
+     *  in must be the stream build2 read the header from.
+     */
+    void decompress(std::ostream& wStream, BitInputStream& in);
+
+    /** Decode the message into the cap bytes at dst.
+     *  PRECONDITION: build2 has read the header from in.
+     *  Return false, without decoding anything, if the message is larger
+     *  than cap bytes.
+     */
+    bool decompress(BitInputStream& in, byte* dst, size_t cap);
+
+    /** Return the number of bytes of the message
+     *  PRECONDITION: build or build2 has been called.
+     */
+    long messageSize() const;
+
+    /** Return the code of every byte, indexed by the byte
+     */
+    const CodeEntry* codes() const { return this->codeTable; }
+
+    /** Build a code to share between messages from the counts of a
+     *  sample of them. Every byte gets a code, so any message can be
+     *  coded with it: the bytes the sample lacks escape to the longest
+     *  codes, of at most codeLengthLimit bits (MAX_HEADER_CODE_LENGTH
+     *  if there is no limit).
+     *  PRECONDITION: freqs[i] is the count of byte i in the sample.
+     */
+    void train(const std::vector<long>& freqs);
+
+    /** Write the code as a table file (FORMAT_TABLE): the magic number,
+     *  the format version and the code lengths of all 256 bytes.
+     *  PRECONDITION: train has been called.
      */
-    void decompress(std::ostream& wStream, std::istream& rStream);
+    void writeTable(BitOutputStream& out) const;
+
+    /** Load the code of a table file written by writeTable, ready to
+     *  code with compressShared and to decode files written with it.
+     *  Return false if in isn't a table file, or the table is damaged.
+     */
+    bool readTable(BitInputStream& in);
+
+    /** Return the number that tells tables apart, the CRC32C of the
+     *  code lengths of all 256 bytes
+     */
+    uint32_t tableId() const;
+
+    /** Compress the n bytes at src into out with the loaded table, and
+     *  flush it. Neither the bytes are counted nor a code header written:
+     *  the file (FORMAT_SHARED) holds the id of the table, the number of
+     *  bytes and the coded bytes.
+     *  PRECONDITION: train or readTable has been called.
+     */
+    void compressShared(BitOutputStream& out, const byte* src, size_t n);
 
     /** Write to the given BitOutputStream
      *  the sequence of bits coding the given symbol.
@@ -82,12 +361,41 @@ public:
      */
     void encode(byte symbol, BitOutputStream& out) const;
 
+    /** Build the table of codes used by encode from the Huffman tree.
+     *  PRECONDITION: root points to the root of the trie, and leaves[i]
+     *  points to the leaf node containing byte i.
+     *  POSTCONDITION: codeTable[i] holds the code of byte i.
+     */
+    void buildCodeTable();
+
     /** Return symbol coded in the next sequence of bits from the stream.
      *  PRECONDITION: build() has been called, to create the coding
      *  tree, and initialize root pointer and leaves vector.
      */
     int decode(BitInputStream& in) const;
 
+    /** Build the lookup tables used by decode from the codes in codeTable.
+     *  PRECONDITION: codeTable holds a prefix code of at most 64 bits,
+     *  or root is a lone leaf.
+     *  POSTCONDITION: decodeTable resolves every code in codeTable.
+     *  A lone byte decodes without reading any bits.
+     */
+    void buildDecodeTable();
+
+    /** Fill the decode table level starting at base and indexed by
+     *  tableBits bits with the codes of the n bytes in syms, whose first
+     *  shift bits have been used by the levels above.
+     *  PRECONDITION: syms is sorted by code.
+     */
+    void fillDecodeTable(const int* syms, int n, int base, int tableBits, int shift);
+
+    /** Function to look up the next code of the stream in the decode table
+     *  and return the byte it represents. Resolves a symbol with one table
+     *  load, or two for codes longer than the primary table.
+     *  PRECONDITION: buildDecodeTable has been called.
+     */
+    int tableLookup(BitInputStream& in) const;
+
     /** Populate the freqs vector with the frequency of each
      *  byte value encountered in the file to be compressed
      *  PRECONDITION: in points to an uncompressed file and build
@@ -96,6 +404,21 @@ public:
      */
     void charCount(std::vector<long>& freqs, BitInputStream& in);
 
+    /** Add the frequency of each byte value among the n bytes at src
+     *  to the freqs vector
+     *  POSTCONDITION: freqs[i] is increased by the count of byte i
+     */
+    static void charCount(std::vector<long>& freqs, const byte* src, size_t n);
+
+    /** Add the frequency of each byte value among the n bytes at src
+     *  to the freqs vector, counting on the given number of threads
+     *  (below 1 for one per hardware thread). Every thread counts its own
+     *  chunk into its own histogram, and the histograms are added up at
+     *  the end.
+     *  POSTCONDITION: freqs[i] is increased by the count of byte i
+     */
+    static void charCount(std::vector<long>& freqs, const byte* src, size_t n, int threads);
+
     /** Populate the freqs vector with the frequency of each
      *  byte value encountered in the file to be compressed
      *  PRECONDITION: in points to a compressed file and build2
@@ -106,24 +429,31 @@ public:
      */
     void charCount2(std::vector<long>& freqs, BitInputStream& in);
 
-    /** Function to set the root to point at an HCNode
+    /** Function to set the root to the HCNode at the given index
      */
-    void setRoot(HCNode* const root);
+    void setRoot(int root);
 
     /** Recursive function to cycle through the Huffman tree
-     *  leaf to root and write huffman code to file in root to leaf order
+     *  leaf to root and write huffman code to file in root to leaf order.
+     *  Only used by encode for codes too long for codeTable.
      */
-    void leafToRoot(HCNode* const ptr, BitOutputStream& out) const;
+    void leafToRoot(int node, BitOutputStream& out) const;
 
     /** Function to cycle through the Huffman tree from root to leaf
-     *  and return the byte represented by the huffman code
+     *  and return the byte represented by the huffman code.
+     *  Reads one bit per branch; kept as the reference for tableLookup.
      */
     int rootToLeaf(BitInputStream& in) const;
 
     /** Recursive function to cycle through the Huffman tree
      *  leaf to root and output huffman code in root to leaf order
      */
-    void traverseToScreen(HCNode* const ptr) const;
+    void traverseToScreen(int node) const;
+
+    /** Function to copy the count of the leaf of each byte to counts[i],
+     *  0 for bytes without a leaf
+     */
+    void leafCounts(long* counts) const;
 
     /** Function to count the number of non-zero leaves in the tree
      */
@@ -134,11 +464,34 @@ public:
     void printHuffman(std::vector<long>& freqs);
 
     /** Function to delete the entire huffman tree
-     *  PRECONDITION: build has been called and a huffman tree exists
-     *  POSTCONDITION: all nodes of the tree have been delete and root
-     *  points to nothing
+     *  POSTCONDITION: all nodes of the tree have been handed back to the
+     *  arena, and root and leaves are HCNode::NONE
      */
-    void deleteTree(HCNode* root);
+    void deleteTree();
 };
 
+/** Implementation of tableLookup
+ */
+inline int HCTree::tableLookup(BitInputStream& in) const
+{
+    //look up the next bits in the primary table
+    int width = this->decodeBits;
+    DecodeEntry e = this->decodeTable[in.peekBits(width)];
+
+    //while the code is longer than the current level
+    while (e.link)
+    {
+        //skip past this level and look up the rest in the subtable
+        in.consumeBits(width);
+        width = e.bits;
+        e = this->decodeTable[e.value + in.peekBits(width)];
+    }
+
+    //consume only the bits of the code itself
+    in.consumeBits(e.bits);
+
+    //return the decoded byte
+    return e.value;
+}
+
 #endif // HCTREE_HPP
@@ -0,0 +1,74 @@
+#include "Huffman.hpp"
+#include "HCTree.hpp"
+#include "BitInputStream.hpp"
+#include "BitOutputStream.hpp"
+
+namespace huffman {
+
+/** Most bytes of a canonical header: magic number and version, the
+ *  message size as a varint, the first and last byte with a code, and
+ *  the 4-bit code lengths of all 256 bytes
+ */
+static const size_t HEADER_BOUND = 4 + 10 + 2 + 128;
+
+/** Return the most bytes compress can write for a message of n bytes
+ */
+size_t compressBound(size_t n)
+{
+    //codes of at most 15 bits are built optimally, so they never
+    //average more than the 8 bits of the bytes themselves
+    return n + HEADER_BOUND;
+}
+
+/** Compress the n bytes at src into the cap bytes at dst.
+ *  Return the number of bytes written to dst, or FAILED if they don't fit.
+ */
+size_t compress(const uint8_t* src, size_t n, uint8_t* dst, size_t cap)
+{
+    //build the code from the bytes in place
+    HCTree codeTree;
+    std::vector<long> freqs(256);
+    codeTree.build(freqs, src, n);
+
+    //write the header and the coded bytes straight into dst
+    BitOutputStream out(reinterpret_cast<char*>(dst), cap);
+    codeTree.compress(out, src, n);
+
+    return out.overflowed() ? FAILED : out.bytesWritten();
+}
+
+/** Return the number of bytes the compressed message in the n bytes
+ *  at src decompresses to, or FAILED if it isn't in a single-table format.
+ */
+size_t decompressedSize(const uint8_t* src, size_t n)
+{
+    //read just the header
+    BitInputStream in(reinterpret_cast<const char*>(src), n);
+    HCTree codeTree;
+    std::vector<long> freqs(256);
+    if (!codeTree.build2(freqs, in, HCTree::readFormat(in)))
+        return FAILED;
+
+    return codeTree.messageSize();
+}
+
+/** Decompress the compressed message in the n bytes at src into the
+ *  cap bytes at dst.
+ *  Return the number of bytes written to dst, or FAILED if the message
+ *  isn't in a single-table format or doesn't fit.
+ */
+size_t decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t cap)
+{
+    //read the header, then decode the rest of the bytes in place
+    BitInputStream in(reinterpret_cast<const char*>(src), n);
+    HCTree codeTree;
+    std::vector<long> freqs(256);
+    if (!codeTree.build2(freqs, in, HCTree::readFormat(in)))
+        return FAILED;
+    if (!codeTree.decompress(in, dst, cap))
+        return FAILED;
+
+    return codeTree.messageSize();
+}
+
+}
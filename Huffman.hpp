@@ -0,0 +1,45 @@
+#ifndef HUFFMAN_HPP
+#define HUFFMAN_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/** The library interface: compress and decompress whole messages
+ *  between buffers in memory, with no streams on the way.
+ *  Compressed messages are in the canonical format, the same as files
+ *  written by compress, so either side can be the tools. decompress
+ *  reads both single-table formats, but not the blocked formats that
+ *  compress writes with -b, -T, -m or -S.
+ */
+namespace huffman {
+
+/** Returned in place of a size if a call fails
+ */
+const size_t FAILED = (size_t)-1;
+
+/** Return the most bytes compress can write for a message of n bytes
+ */
+size_t compressBound(size_t n);
+
+/** Compress the n bytes at src into the cap bytes at dst.
+ *  Return the number of bytes written to dst, or FAILED if they don't
+ *  fit. A cap of compressBound(n) is always enough.
+ */
+size_t compress(const uint8_t* src, size_t n, uint8_t* dst, size_t cap);
+
+/** Return the number of bytes the compressed message in the n bytes
+ *  at src decompresses to, from its header alone, or FAILED if it isn't
+ *  in a single-table format.
+ */
+size_t decompressedSize(const uint8_t* src, size_t n);
+
+/** Decompress the compressed message in the n bytes at src into the
+ *  cap bytes at dst.
+ *  Return the number of bytes written to dst, or FAILED if the message
+ *  isn't in a single-table format or doesn't fit.
+ */
+size_t decompress(const uint8_t* src, size_t n, uint8_t* dst, size_t cap);
+
+}
+
+#endif // HUFFMAN_HPP
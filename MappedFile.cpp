@@ -0,0 +1,57 @@
+#include "MappedFile.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** Map the file named path for sequential reading.
+ *  POSTCONDITION: isMapped() tells if the mapping worked. An empty
+ *  regular file counts as mapped, with no bytes.
+ */
+MappedFile::MappedFile(const std::string& path) : addr(0), length(0), mapped(false)
+{
+    //"-" is the standard input, which is read as a stream
+    if (path == "-")
+        return;
+
+    //only regular files can be mapped
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return;
+    }
+
+    //an empty file has nothing to map
+    this->length = st.st_size;
+    if (this->length == 0)
+        this->mapped = true;
+    else
+    {
+        void* p = mmap(0, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            //the file is read front to back, so let the kernel read ahead
+            //and drop pages behind us
+            madvise(p, this->length, MADV_SEQUENTIAL);
+            this->addr = static_cast<const unsigned char*>(p);
+            this->mapped = true;
+        }
+        else
+            this->length = 0;
+    }
+
+    //the mapping stays valid after the file is closed
+    close(fd);
+}
+
+/** Unmap the file
+ */
+MappedFile::~MappedFile()
+{
+    if (this->addr != 0)
+        munmap(const_cast<unsigned char*>(this->addr), this->length);
+}
@@ -0,0 +1,48 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <string>
+#include <cstddef>
+
+/** A read-only memory mapping of a whole file, so its bytes can be
+ *  read in place as one contiguous span instead of through a stream.
+ *  Files that can't be mapped, like pipes and terminals, are left
+ *  unmapped, and the caller falls back to reading them as a stream.
+ */
+class MappedFile {
+private:
+    const unsigned char* addr;  // the first byte of the mapping
+    size_t length;              // the number of bytes in the file
+    bool mapped;                // set if the whole file is available at addr
+
+    /** Mappings can't be shared between owners
+     */
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    /** Map the file named path for sequential reading.
+     *  POSTCONDITION: isMapped() tells if the mapping worked. An empty
+     *  regular file counts as mapped, with no bytes.
+     */
+    explicit MappedFile(const std::string& path);
+
+    /** Unmap the file
+     */
+    ~MappedFile();
+
+    /** Check if the file is available as a span of bytes
+     */
+    bool isMapped() const { return this->mapped; }
+
+    /** The bytes of the file
+     *  PRECONDITION: isMapped()
+     */
+    const unsigned char* data() const { return this->addr; }
+
+    /** The number of bytes in the file
+     */
+    size_t size() const { return this->length; }
+};
+
+#endif // MAPPEDFILE_HPP
@@ -0,0 +1,126 @@
+#include "Stats.hpp"
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+Stats::Stats() : totalSeconds(0), messageBytes(0), codedBytes(0), payloadBits(0), maxCodeLength(0)
+{
+    std::fill(this->seconds, this->seconds + PHASES, 0.0);
+    std::fill(this->freqs, this->freqs + 256, 0L);
+}
+
+/** Return the seconds since some fixed point in time, to time
+ *  phases with.
+ */
+double Stats::now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Add the times, sizes and byte counts of other, like the stats of
+ *  one block, to these.
+ */
+void Stats::add(const Stats& other)
+{
+    for (int p = 0; p < PHASES; p++)
+        this->seconds[p] += other.seconds[p];
+    this->messageBytes += other.messageBytes;
+    this->codedBytes += other.codedBytes;
+    this->payloadBits += other.payloadBits;
+    this->maxCodeLength = std::max(this->maxCodeLength, other.maxCodeLength);
+    for (int i = 0; i < 256; i++)
+        this->freqs[i] += other.freqs[i];
+}
+
+/** Set totalSeconds to the time since start. If no I/O was timed on
+ *  its own, the wall time the other phases don't account for is
+ *  charged to IO.
+ */
+void Stats::finish(double start)
+{
+    this->totalSeconds = now() - start;
+
+    //on a single thread, whatever isn't counting, building or coding
+    //is reading and writing
+    if (this->seconds[IO] == 0)
+    {
+        double timed = this->seconds[COUNT] + this->seconds[BUILD] + this->seconds[CODE];
+        this->seconds[IO] = std::max(this->totalSeconds - timed, 0.0);
+    }
+}
+
+/** Return the Shannon entropy of the bytes of the message in bits
+ *  per byte, the fewest bits per byte any order-0 code can average.
+ */
+double Stats::entropy() const
+{
+    if (this->messageBytes == 0)
+        return 0;
+
+    //add up -p log2 p over the bytes that occur
+    double bits = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        if (this->freqs[i] > 0)
+        {
+            double p = (double)this->freqs[i] / this->messageBytes;
+            bits -= p * std::log2(p);
+        }
+    }
+
+    return bits;
+}
+
+/** Return the average length of the codes of the message in bits
+ *  per byte.
+ */
+double Stats::averageCodeLength() const
+{
+    return this->messageBytes == 0 ? 0 : (double)this->payloadBits / this->messageBytes;
+}
+
+/** Print the stats, one per line, with the throughput of every
+ *  phase in message bytes per second. encoding picks the name of
+ *  the coding phase.
+ */
+void Stats::print(std::ostream& out, bool encoding) const
+{
+    static const char* const PHASE_NAMES[PHASES] = { "count", "build", 0, "io" };
+    double mb = this->messageBytes / 1e6;
+
+    //the time and throughput of every phase, then of the whole run
+    out << std::left << std::setw(16) << "phase" << std::right
+        << std::setw(12) << "seconds" << std::setw(12) << "MB/s" << std::endl;
+    for (int p = 0; p <= PHASES; p++)
+    {
+        double s = (p == PHASES) ? this->totalSeconds : this->seconds[p];
+        const char* name = (p == PHASES) ? "total" : (p == CODE) ? (encoding ? "encode" : "decode") : PHASE_NAMES[p];
+
+        out << std::left << std::setw(16) << name << std::right << std::fixed
+            << std::setprecision(6) << std::setw(12) << s << std::setprecision(1) << std::setw(12);
+        if (s > 0)
+            out << mb / s << std::endl;
+        else
+            out << "-" << std::endl;
+    }
+
+    //the payload is the coded bytes, everything else in the file is
+    //headers and padding to whole bytes
+    long payloadBytes = (this->payloadBits + 7) / 8;
+    out << std::left << std::setw(16) << "message bytes" << std::right << std::setw(24) << this->messageBytes << std::endl;
+    out << std::left << std::setw(16) << "coded bytes" << std::right << std::setw(24) << this->codedBytes << std::endl;
+    out << std::left << std::setw(16) << "header bytes" << std::right << std::setw(24)
+        << std::max(this->codedBytes - payloadBytes, 0L) << std::endl;
+    out << std::left << std::setw(16) << "payload bytes" << std::right << std::setw(24) << payloadBytes << std::endl;
+
+    //the ratio is coded bytes per message byte, smaller is better
+    out << std::left << std::setw(16) << "ratio" << std::right << std::setprecision(4) << std::setw(24)
+        << (this->messageBytes == 0 ? 0.0 : (double)this->codedBytes / this->messageBytes) << std::endl;
+    out << std::left << std::setw(16) << "entropy" << std::right << std::setw(24) << this->entropy()
+        << " bits/byte" << std::endl;
+    out << std::left << std::setw(16) << "average code" << std::right << std::setw(24) << this->averageCodeLength()
+        << " bits/byte" << std::endl;
+    out << std::left << std::setw(16) << "max code" << std::right << std::setw(24) << this->maxCodeLength
+        << " bits" << std::endl;
+}
@@ -0,0 +1,63 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <iostream>
+
+/** Statistics of one run of compress or uncompress: where the time went
+ *  and what the code looked like.
+ *  HCTree and BlockCoder add to the Stats object they are given with
+ *  setStats, and the tools print it for --stats.
+ */
+struct Stats {
+    /** The phases the time is split into
+     */
+    static const int COUNT = 0;   // counting the bytes of the message
+    static const int BUILD = 1;   // building the code, or reading it back from a header
+    static const int CODE = 2;    // encoding or decoding the bytes
+    static const int IO = 3;      // reading and writing the files
+    static const int PHASES = 4;
+
+    double seconds[PHASES];  // time spent in each phase, added up over threads
+    double totalSeconds;     // wall time of the whole run
+    long messageBytes;       // bytes of the uncompressed message
+    long codedBytes;         // bytes of the compressed file
+    long payloadBits;        // bits of coded bytes, the rest of the file is headers and padding
+    int maxCodeLength;       // length of the longest code used
+    long freqs[256];         // count of every byte of the message
+
+    Stats();
+
+    /** Return the seconds since some fixed point in time, to time
+     *  phases with.
+     */
+    static double now();
+
+    /** Add the times, sizes and byte counts of other, like the stats of
+     *  one block, to these.
+     */
+    void add(const Stats& other);
+
+    /** Set totalSeconds to the time since start. If no I/O was timed on
+     *  its own, the wall time the other phases don't account for is
+     *  charged to IO.
+     */
+    void finish(double start);
+
+    /** Return the Shannon entropy of the bytes of the message in bits
+     *  per byte, the fewest bits per byte any order-0 code can average.
+     */
+    double entropy() const;
+
+    /** Return the average length of the codes of the message in bits
+     *  per byte.
+     */
+    double averageCodeLength() const;
+
+    /** Print the stats, one per line, with the throughput of every
+     *  phase in message bytes per second. encoding picks the name of
+     *  the coding phase.
+     */
+    void print(std::ostream& out, bool encoding) const;
+};
+
+#endif // STATS_HPP
@@ -0,0 +1,86 @@
+#include "ThreadPool.hpp"
+
+/** Start a pool of the given number of worker threads.
+ *  A count below 1 uses one thread per hardware thread.
+ */
+ThreadPool::ThreadPool(int threads) : stopping(false)
+{
+    //default to the number of hardware threads
+    if (threads < 1)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    //start the workers
+    for (int i = 0; i < threads; i++)
+        this->workers.push_back(std::thread(&ThreadPool::work, this));
+}
+
+/** Finish the jobs already submitted and join the workers
+ */
+ThreadPool::~ThreadPool()
+{
+    //tell the workers to stop once the queue is empty
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->ready.notify_all();
+
+    //wait for all of them to finish
+    for (size_t i = 0; i < this->workers.size(); i++)
+        this->workers[i].join();
+}
+
+/** Queue a job for the next free worker.
+ *  Return a future that becomes ready when the job has run.
+ */
+std::future<void> ThreadPool::submit(std::function<void()> job)
+{
+    //wrap the job so its completion can be waited on
+    std::shared_ptr<std::packaged_task<void()> > task =
+        std::make_shared<std::packaged_task<void()> >(job);
+    std::future<void> done = task->get_future();
+
+    //queue it and wake up a worker
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->jobs.push_back([task]() { (*task)(); });
+    }
+    this->ready.notify_one();
+
+    return done;
+}
+
+/** Return the number of worker threads
+ */
+int ThreadPool::size() const
+{
+    return this->workers.size();
+}
+
+/** Loop run by every worker: take the next job and run it, until
+ *  the pool is stopping and no jobs are left.
+ */
+void ThreadPool::work()
+{
+    while (true)
+    {
+        std::function<void()> job;
+
+        //wait for a job, or for the pool to stop
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+            this->ready.wait(guard, [this]() { return this->stopping || !this->jobs.empty(); });
+
+            //if there is nothing left to do, we are done
+            if (this->jobs.empty())
+                return;
+
+            //take the oldest job
+            job = this->jobs.front();
+            this->jobs.pop_front();
+        }
+
+        //run the job outside the lock
+        job();
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <algorithm>
+
+/** A fixed-size pool of worker threads that run submitted jobs
+ *  in the order they were submitted.
+ */
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;           // the worker threads
+    std::deque<std::function<void()> > jobs;    // jobs waiting for a worker
+    std::mutex lock;                            // guards jobs and stopping
+    std::condition_variable ready;              // signals new jobs or stopping
+    bool stopping;                              // set when the pool shuts down
+
+    /** Loop run by every worker: take the next job and run it, until
+     *  the pool is stopping and no jobs are left.
+     */
+    void work();
+
+public:
+    /** Start a pool of the given number of worker threads.
+     *  A count below 1 uses one thread per hardware thread.
+     */
+    explicit ThreadPool(int threads);
+
+    /** Finish the jobs already submitted and join the workers
+     */
+    ~ThreadPool();
+
+    /** Queue a job for the next free worker.
+     *  Return a future that becomes ready when the job has run.
+     */
+    std::future<void> submit(std::function<void()> job);
+
+    /** Return the number of worker threads
+     */
+    int size() const;
+};
+
+#endif // THREADPOOL_HPP
@@ -0,0 +1,332 @@
+#include "HCTree.hpp"
+#include "BitInputStream.hpp"
+#include "BitOutputStream.hpp"
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+
+/** A named set of messages, every one compressed on its own
+ */
+struct Corpus {
+    string name;                            // what the messages hold
+    std::vector<std::vector<byte> > messages;
+    size_t bytes;                           // bytes in all the messages
+};
+
+/** The phases of HCTree that are timed
+ */
+static const int PHASES = 5;
+static const char* const PHASE_NAMES[PHASES] = { "count", "build", "encode", "table", "decode" };
+
+/** Parse a size in bytes with an optional K, M or G suffix
+ */
+static size_t parseSize(const string& arg)
+{
+    //read the number and scale it by the suffix
+    char* end;
+    size_t size = strtoul(arg.c_str(), &end, 10);
+    if (*end == 'K' || *end == 'k')
+        size *= 1024;
+    else if (*end == 'M' || *end == 'm')
+        size *= 1024 * 1024;
+    else if (*end == 'G' || *end == 'g')
+        size *= 1024 * 1024 * 1024;
+
+    return size;
+}
+
+/** Return the next number of a xorshift64* generator, so that every
+ *  run of the benchmark sees the same corpus
+ */
+static uint64_t nextRandom(uint64_t& state)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+}
+
+/** Make n bytes of text: words of a fixed made-up vocabulary, picked
+ *  with Zipf frequencies, with line breaks and some punctuation
+ */
+static std::vector<byte> makeText(size_t n, uint64_t seed)
+{
+    //make up the vocabulary
+    uint64_t state = seed;
+    std::vector<string> words(4096);
+    for (size_t i = 0; i < words.size(); i++)
+    {
+        int length = 1 + nextRandom(state) % 3 + nextRandom(state) % 8;
+        //the smaller of two picks favours the letters in front
+        for (int k = 0; k < length; k++)
+            words[i] += "etaoinshrdlucmfwypvbgkjqxz"[std::min(nextRandom(state) % 26, nextRandom(state) % 26)];
+    }
+
+    //word i is picked with a weight of 1 / (i + 1)
+    std::vector<double> cumulative(words.size());
+    double total = 0;
+    for (size_t i = 0; i < words.size(); i++)
+        cumulative[i] = (total += 1.0 / (i + 1));
+
+    std::vector<byte> text;
+    text.reserve(n + 16);
+    int column = 0;
+    while (text.size() < n)
+    {
+        //pick the next word
+        double pick = (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0) * total;
+        size_t i = std::lower_bound(cumulative.begin(), cumulative.end(), pick) - cumulative.begin();
+        const string& word = words[std::min(i, words.size() - 1)];
+        text.insert(text.end(), word.begin(), word.end());
+        column += word.size() + 1;
+
+        //and what follows it
+        if (nextRandom(state) % 16 == 0)
+            text.push_back(",.;"[nextRandom(state) % 3]);
+        if (column > 72)
+        {
+            text.push_back('\n');
+            column = 0;
+        }
+        else
+            text.push_back(' ');
+    }
+
+    text.resize(n);
+    return text;
+}
+
+/** Make n bytes of a sparse binary dump: most pages are zeros, the
+ *  rest holds bytes with a geometric distribution
+ */
+static std::vector<byte> makeSkewed(size_t n, uint64_t seed)
+{
+    uint64_t state = seed;
+    std::vector<byte> data(n);
+    for (size_t page = 0; page < n; page += 4096)
+    {
+        //leave three pages in four zero
+        if (nextRandom(state) % 4 != 0)
+            continue;
+
+        //byte k shows up with probability 2^-(k+1)
+        for (size_t i = page; i < std::min(n, page + 4096); i++)
+        {
+            uint64_t r = nextRandom(state) | (1ULL << 63);
+            data[i] = std::min(__builtin_ctzll(r), 255);
+        }
+    }
+
+    return data;
+}
+
+/** Make n bytes with every byte value equally likely
+ */
+static std::vector<byte> makeRandom(size_t n, uint64_t seed)
+{
+    uint64_t state = seed;
+    std::vector<byte> data(n);
+    for (size_t i = 0; i < n; i++)
+        data[i] = nextRandom(state) >> 56;
+
+    return data;
+}
+
+/** Make a corpus of a single message
+ */
+static Corpus makeCorpus(const string& name, const std::vector<byte>& message)
+{
+    Corpus corpus;
+    corpus.name = name;
+    corpus.messages.push_back(message);
+    corpus.bytes = message.size();
+    return corpus;
+}
+
+/** Make the corpus: text, skewed binary, uniform random and single byte
+ *  messages of size bytes, many tiny text messages, and if large isn't
+ *  0, a text message of large bytes
+ */
+static std::vector<Corpus> makeCorpora(size_t size, size_t large)
+{
+    std::vector<Corpus> corpora;
+    corpora.push_back(makeCorpus("text", makeText(size, 1)));
+    corpora.push_back(makeCorpus("skewed", makeSkewed(size, 2)));
+    corpora.push_back(makeCorpus("random", makeRandom(size, 3)));
+    corpora.push_back(makeCorpus("single", std::vector<byte>(size, 'a')));
+
+    //tiny messages pay for a whole table each
+    Corpus tiny;
+    tiny.name = "tiny";
+    tiny.bytes = 0;
+    for (int i = 0; i < 4096; i++)
+    {
+        tiny.messages.push_back(makeText(64, 100 + i));
+        tiny.bytes += 64;
+    }
+    corpora.push_back(tiny);
+
+    if (large > 0)
+        corpora.push_back(makeCorpus("large", makeText(large, 4)));
+
+    return corpora;
+}
+
+/** Return the seconds since start
+ */
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/** Compress and decompress every message of the corpus once, adding the
+ *  time each phase took to seconds.
+ *  Return false if a message didn't come back the same.
+ */
+static bool runOnce(const Corpus& corpus, double seconds[PHASES])
+{
+    bool ok = true;
+    std::vector<char> coded;
+    std::vector<byte> decoded;
+
+    for (size_t m = 0; m < corpus.messages.size(); m++)
+    {
+        const std::vector<byte>& message = corpus.messages[m];
+        const byte* src = message.data();
+        size_t n = message.size();
+
+        //count the bytes
+        auto start = std::chrono::steady_clock::now();
+        std::vector<long> freqs(256);
+        HCTree::charCount(freqs, src, n);
+        seconds[0] += secondsSince(start);
+
+        //build the code
+        start = std::chrono::steady_clock::now();
+        HCTree encoder;
+        encoder.buildTree(freqs);
+        seconds[1] += secondsSince(start);
+
+        //encode the message the way compress does
+        coded.clear();
+        coded.reserve(n + n / 8 + 1024);
+        start = std::chrono::steady_clock::now();
+        {
+            BitOutputStream out(coded);
+            encoder.writeHeader(out);
+            if (encoder.leafCount() > 1)
+            {
+                for (size_t i = 0; i < n; i++)
+                    encoder.encode(src[i], out);
+            }
+            out.flush();
+        }
+        seconds[2] += secondsSince(start);
+
+        //read the header and build the decode table the way uncompress
+        //does, timed apart from the decoding itself
+        decoded.resize(n);
+        start = std::chrono::steady_clock::now();
+        BitInputStream in(coded.data(), coded.size());
+        HCTree decoder;
+        std::vector<long> decodedFreqs(256);
+        decoder.build2(decodedFreqs, in, HCTree::readFormat(in));
+        seconds[3] += secondsSince(start);
+
+        //decode it again
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < n; i++)
+            decoded[i] = decoder.decode(in);
+        seconds[4] += secondsSince(start);
+
+        ok = ok && std::equal(decoded.begin(), decoded.end(), src);
+    }
+
+    return ok;
+}
+
+/** Return the p-th percentile of the values, the smallest value that
+ *  at least p percent of them are at most
+ */
+static double percentile(std::vector<double> values, double p)
+{
+    std::sort(values.begin(), values.end());
+    size_t rank = (size_t)std::ceil(p / 100 * values.size());
+    return values[std::max(rank, (size_t)1) - 1];
+}
+
+int main(int argc, char* argv[])
+{
+    //read the options
+    int runs = 11;
+    size_t size = 16 * 1024 * 1024;
+    size_t large = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+
+        //-r N times every phase over N runs
+        if (arg == "-r" && i + 1 < argc)
+            runs = std::max(atoi(argv[++i]), 1);
+        //-s SIZE sets the size of the regular messages
+        else if (arg == "-s" && i + 1 < argc)
+            size = parseSize(argv[++i]);
+        //-l SIZE adds a text message of SIZE bytes, like 4G
+        else if (arg == "-l" && i + 1 < argc)
+            large = parseSize(argv[++i]);
+        else
+        {
+            std::cout << "Usage: bench [-r runs] [-s size] [-l large size]" << std::endl;
+            return 1;
+        }
+    }
+
+    //print the header of the table
+    std::cout << std::left << setw(8) << "corpus" << setw(8) << "phase" << std::right
+              << setw(12) << "MB/s med" << setw(12) << "MB/s p99"
+              << setw(12) << "ns/B med" << setw(12) << "ns/B p99" << std::endl;
+
+    bool ok = true;
+    std::vector<Corpus> corpora = makeCorpora(size, large);
+    for (size_t c = 0; c < corpora.size(); c++)
+    {
+        const Corpus& corpus = corpora[c];
+
+        //time every phase over all the runs
+        std::vector<double> times[PHASES];
+        for (int r = 0; r < runs; r++)
+        {
+            double seconds[PHASES] = { 0 };
+            ok = runOnce(corpus, seconds) && ok;
+            for (int p = 0; p < PHASES; p++)
+                times[p].push_back(seconds[p]);
+        }
+
+        //the p99 is the slow end, so it goes with the low end of the throughput
+        for (int p = 0; p < PHASES; p++)
+        {
+            double median = percentile(times[p], 50);
+            double slow = percentile(times[p], 99);
+            double mb = corpus.bytes / 1e6;
+            std::cout << std::left << setw(8) << corpus.name << setw(8) << PHASE_NAMES[p] << std::right
+                      << std::fixed << std::setprecision(1)
+                      << setw(12) << mb / median << setw(12) << mb / slow
+                      << std::setprecision(3)
+                      << setw(12) << median * 1e9 / corpus.bytes << setw(12) << slow * 1e9 / corpus.bytes
+                      << std::endl;
+        }
+    }
+
+    //a benchmark of a broken coder is worth nothing
+    if (!ok)
+    {
+        std::cerr << "Error. A message didn't decompress to itself." << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
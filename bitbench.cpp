@@ -0,0 +1,205 @@
+#include "BitInputStream.hpp"
+#include "BitOutputStream.hpp"
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+//cycles are read from the time stamp counter on x86, elsewhere
+//nanoseconds stand in for them
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+static uint64_t readCycles() { return __rdtsc(); }
+#else
+static uint64_t readCycles()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+/** The time and cycles one run of a pattern took
+ */
+struct Sample {
+    double seconds;
+    double cycles;
+};
+
+/** Return the next number of a xorshift64* generator, so that every
+ *  run of the benchmark sees the same data
+ */
+static uint64_t nextRandom(uint64_t& state)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+}
+
+/** Run f once and return how long it took
+ */
+template <typename F>
+static Sample measure(F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    uint64_t startCycles = readCycles();
+    f();
+    uint64_t cycles = readCycles() - startCycles;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return Sample{ seconds, (double)cycles };
+}
+
+/** Run f the given number of times and print the median cycles per bit
+ *  and bytes per second of moving the given number of bits
+ */
+template <typename F>
+static void report(const string& name, int runs, size_t bits, F f)
+{
+    std::vector<Sample> samples;
+    for (int r = 0; r < runs; r++)
+        samples.push_back(measure(f));
+
+    //the median run by time
+    std::sort(samples.begin(), samples.end(), [](const Sample& a, const Sample& b)
+    {
+        return a.seconds < b.seconds;
+    });
+    const Sample& median = samples[samples.size() / 2];
+
+    std::cout << std::left << setw(16) << name << std::right << std::fixed
+              << std::setprecision(3) << setw(14) << median.cycles / bits
+              << std::setprecision(1) << setw(14) << bits / 8 / median.seconds / 1e6
+              << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    //read the options
+    int runs = 11;
+    size_t bytes = 16 * 1024 * 1024;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+
+        //-r N takes the median of N runs
+        if (arg == "-r" && i + 1 < argc)
+            runs = std::max(atoi(argv[++i]), 1);
+        //-s N moves N megabytes per run
+        else if (arg == "-s" && i + 1 < argc)
+            bytes = std::max(atoi(argv[++i]), 1) * (size_t)1024 * 1024;
+        else
+        {
+            std::cout << "Usage: bitbench [-r runs] [-s megabytes]" << std::endl;
+            return 1;
+        }
+    }
+
+    //the data to write: one value per bit, byte, or field of 1 to 24 bits,
+    //with the fields adding up to about the same number of bits
+    uint64_t state = 1;
+    size_t bits = bytes * 8;
+    std::vector<uint8_t> bitValues(bits), byteValues(bytes);
+    for (size_t i = 0; i < bits; i++)
+        bitValues[i] = nextRandom(state) >> 63;
+    for (size_t i = 0; i < bytes; i++)
+        byteValues[i] = nextRandom(state) >> 56;
+    std::vector<uint32_t> fieldValues;
+    std::vector<uint8_t> fieldWidths;
+    size_t fieldBits = 0;
+    while (fieldBits < bits)
+    {
+        int width = 1 + nextRandom(state) % 24;
+        fieldWidths.push_back(width);
+        fieldValues.push_back(nextRandom(state) >> (64 - width));
+        fieldBits += width;
+    }
+
+    //where the patterns are written to, and read back from
+    std::vector<char> bitStream, byteStream, fieldStream;
+    bitStream.reserve(bytes + 16);
+    byteStream.reserve(bytes + 16);
+    fieldStream.reserve(fieldBits / 8 + 16);
+
+    //anything read is added up here, so the reads can't be left out
+    volatile uint64_t sink = 0;
+
+    std::cout << std::left << setw(16) << "pattern" << std::right
+              << setw(14) << "cycles/bit" << setw(14) << "MB/s" << std::endl;
+
+    report("writeBit", runs, bits, [&]()
+    {
+        bitStream.clear();
+        BitOutputStream out(bitStream);
+        for (size_t i = 0; i < bits; i++)
+            out.writeBit(bitValues[i]);
+        out.flush();
+    });
+
+    report("writeBits 1-24", runs, fieldBits, [&]()
+    {
+        fieldStream.clear();
+        BitOutputStream out(fieldStream);
+        for (size_t i = 0; i < fieldValues.size(); i++)
+            out.writeBits(fieldValues[i], fieldWidths[i]);
+        out.flush();
+    });
+
+    report("writeByte", runs, bits, [&]()
+    {
+        byteStream.clear();
+        BitOutputStream out(byteStream);
+        for (size_t i = 0; i < bytes; i++)
+            out.writeByte(byteValues[i]);
+        out.flush();
+    });
+
+    report("readBit", runs, bits, [&]()
+    {
+        BitInputStream in(bitStream.data(), bitStream.size());
+        uint64_t sum = 0;
+        for (size_t i = 0; i < bits; i++)
+            sum += in.readBit();
+        sink = sink + sum;
+    });
+
+    report("readBits 1-24", runs, fieldBits, [&]()
+    {
+        BitInputStream in(fieldStream.data(), fieldStream.size());
+        uint64_t sum = 0;
+        for (size_t i = 0; i < fieldWidths.size(); i++)
+            sum += in.readBits(fieldWidths[i]);
+        sink = sink + sum;
+    });
+
+    report("readByte", runs, bits, [&]()
+    {
+        BitInputStream in(byteStream.data(), byteStream.size());
+        uint64_t sum = 0;
+        for (size_t i = 0; i < bytes; i++)
+            sum += in.readByte();
+        sink = sink + sum;
+    });
+
+    //make sure the streams read back what was written
+    BitInputStream bitIn(bitStream.data(), bitStream.size());
+    BitInputStream fieldIn(fieldStream.data(), fieldStream.size());
+    BitInputStream byteIn(byteStream.data(), byteStream.size());
+    bool ok = true;
+    for (size_t i = 0; i < bits; i++)
+        ok = ok && bitIn.readBit() == bitValues[i];
+    for (size_t i = 0; i < fieldValues.size(); i++)
+        ok = ok && fieldIn.readBits(fieldWidths[i]) == fieldValues[i];
+    for (size_t i = 0; i < bytes; i++)
+        ok = ok && byteIn.readByte() == byteValues[i];
+
+    if (!ok)
+    {
+        std::cerr << "Error. A stream didn't read back what was written." << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
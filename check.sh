@@ -0,0 +1,113 @@
+#!/bin/sh
+# Round trips compress and uncompress over the sources of this directory,
+# run by "make check". Prints every failure and exits with 1 if there is any.
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+failed=0
+
+fail()
+{
+    echo "FAILED: $1"
+    failed=1
+}
+
+# the sources make a text input, an empty file the smallest one
+cat *.cpp *.hpp > "$dir/in"
+: > "$dir/empty"
+tail -c +5001 "$dir/in" | head -c 8000 > "$dir/part"
+
+# an output of - writes the standard output, and an input of - reads
+# the standard input, in every format
+for flags in "" "-b 4K" "-b 4K -S -T 4" "-b 4K --checksum --index" "--context 16"; do
+    for input in in empty; do
+        ./compress $flags "$dir/$input" - > "$dir/c.hc" || fail "compress $flags $input -"
+        ./uncompress -T 4 "$dir/c.hc" - | cmp -s - "$dir/$input" || fail "uncompress - of compress $flags $input"
+        ./uncompress - - < "$dir/c.hc" | cmp -s - "$dir/$input" || fail "uncompress - - of compress $flags $input"
+    done
+done
+
+# blocks written to the standard output go after what is already there,
+# whether it appends or not, and before what is written after them
+./compress -b 4K "$dir/in" "$dir/c.hc"
+echo head > "$dir/out"
+./uncompress -T 4 "$dir/c.hc" - >> "$dir/out"
+(echo head; cat "$dir/in") | cmp -s - "$dir/out" || fail "uncompress - appending"
+(echo head; ./uncompress -T 4 "$dir/c.hc" -; echo tail) > "$dir/out"
+(echo head; cat "$dir/in"; echo tail) | cmp -s - "$dir/out" || fail "uncompress - between other output"
+
+# the standard input can be compressed too
+./compress - - < "$dir/in" | cat > "$dir/c.hc"
+./uncompress "$dir/c.hc" "$dir/out" && cmp -s "$dir/out" "$dir/in" || fail "compress - -"
+
+# --verify reports damaged blocks, both a damaged payload and a damaged
+# size field, with 4K blocks the body size of the first block is at 8
+./compress -b 4K --checksum "$dir/in" "$dir/c.hc"
+./uncompress --verify "$dir/c.hc" > /dev/null || fail "verify of an intact file"
+for damage in "8 \377\377\377\377\377\377\377\017" "100 \125"; do
+    cp "$dir/c.hc" "$dir/bad.hc"
+    printf "${damage#* }" | dd of="$dir/bad.hc" bs=1 seek=${damage%% *} conv=notrunc 2> /dev/null
+    ./uncompress --verify "$dir/bad.hc" > /dev/null 2>&1
+    [ $? -eq 1 ] || fail "verify of a file damaged at byte ${damage%% *}"
+done
+
+# -L limits the code lengths, and the limited code still round trips
+for flags in "-L 7" "-L 7 -b 4K"; do
+    ./compress $flags --stats "$dir/in" "$dir/c.hc" 2> "$dir/stats"
+    grep -q "max code  *[1-7] bits" "$dir/stats" || fail "compress $flags code lengths"
+    ./uncompress "$dir/c.hc" "$dir/out" && cmp -s "$dir/out" "$dir/in" || fail "uncompress of compress $flags"
+done
+
+# --range writes just part of the message of a blocked file, found with
+# the index or by stepping over the blocks, up to the end if Y is left out
+for flags in "-b 4K" "-b 4K --index" "-b 4K -S --checksum --index"; do
+    ./compress $flags "$dir/in" "$dir/c.hc"
+    ./uncompress --range 5000:13000 "$dir/c.hc" - | cmp -s - "$dir/part" || fail "uncompress --range 5000:13000 of $flags"
+    ./uncompress --range 5000 "$dir/c.hc" "$dir/out"
+    tail -c +5001 "$dir/in" | cmp -s - "$dir/out" || fail "uncompress --range 5000 of $flags"
+done
+
+# a table trained on samples codes files in both directions, and files
+# coded with it can't be read without it
+./train "$dir/table" "$dir/in" README.md || fail "train"
+for input in in empty; do
+    ./compress --table "$dir/table" "$dir/$input" "$dir/c.hc" || fail "compress --table $input"
+    ./uncompress --table "$dir/table" "$dir/c.hc" "$dir/out" && cmp -s "$dir/out" "$dir/$input" ||
+        fail "uncompress --table of $input"
+done
+./uncompress "$dir/c.hc" "$dir/out" 2> /dev/null && fail "uncompress without the table"
+
+# --batch takes a list file or two directories, with or without a table
+mkdir "$dir/batch"
+cp *.hpp "$dir/batch"
+printf "%s\t%s\n" "$dir/in" "$dir/in.hc" "$dir/empty" "$dir/empty.hc" > "$dir/list"
+printf "%s %s\n" "$dir/in.hc" "$dir/in.out" "$dir/empty.hc" "$dir/empty.out" > "$dir/list2"
+./compress --batch "$dir/list" && ./uncompress --batch "$dir/list2" || fail "--batch of a list file"
+cmp -s "$dir/in" "$dir/in.out" && cmp -s "$dir/empty" "$dir/empty.out" || fail "round trip through --batch of a list file"
+for flags in "" "--table $dir/table"; do
+    rm -rf "$dir/batch.hc" "$dir/batch.out"
+    ./compress $flags --batch "$dir/batch" "$dir/batch.hc" && ./uncompress $flags --batch "$dir/batch.hc" "$dir/batch.out" &&
+        diff -r "$dir/batch" "$dir/batch.out" > /dev/null || fail "round trip through --batch $flags of a directory"
+done
+
+# files in the legacy format, with no magic number, still uncompress
+./uncompress testdata/legacy.hc "$dir/out" && cmp -s "$dir/out" testdata/legacy.txt || fail "uncompress of a legacy file"
+
+# a file in a batch that isn't compressed fails on its own, and the rest
+# of the batch still comes out
+mkdir "$dir/junk"
+./compress "$dir/in" "$dir/junk/good"
+head -c 100 /dev/urandom > "$dir/junk/random"
+./uncompress --batch "$dir/junk" "$dir/junkout" 2> "$dir/err"
+[ $? -eq 1 ] && grep -q "random is damaged" "$dir/err" || fail "uncompress --batch of a file that isn't compressed"
+cmp -s "$dir/junkout/good" "$dir/in" || fail "uncompress --batch next to a file that isn't compressed"
+
+# the library round trips messages in memory, and its push interface
+# reads and writes blocked files in pieces
+./compress -b 4K "$dir/in" "$dir/c.hc"
+./libcheck "$dir/in" "$dir/c.hc" || fail "libcheck"
+
+if [ $failed -eq 0 ]; then
+    echo "All checks passed."
+fi
+exit $failed
@@ -1,75 +1,390 @@
-#include "HCTree.hpp"
-#include "BitInputStream.hpp"
-#include <iostream>
-#include <fstream>
-#include <cstdlib>
-
-int main(int argc, char* argv[])
-{
-    //notify user if the right number of arguments weren't provided
-    if (argc != 3)
-        std::cout << "You need to provide 2 input arguments for this program." << std::endl;
-    else
-    {
-        //set filenames to process from input argument
-        string rFile = argv[1], wFile = argv[2];
-
-        // create a file buffer for the input file
-        std::filebuf rBuf;
-
-        //create a huffman tree
-        HCTree codeTree;
-
-        // if we can open the input file with the file buffer
-        if (rBuf.open(rFile, std::ios::in | std::ios::binary))
-        {
-
-            //connect to the input file
-            std::istream rStream(&rBuf);
-
-            //create a vectors of ints to store the frequencies of the bytes
-            //in the input file
-            std::vector<long> freqs(256);
-
-            //build the Huffman tree from the input file
-            codeTree.build(freqs, rStream);
-
-            //close the input file buffer
-            rBuf.close();
-        }
-        else
-            // notify user that the input file couldn't be opened
-            std::cerr << "Error. " << rFile << " couldn't be opened. Compression failed." << std::endl;
-
-        // create a 2nd file buffer for the output file
-        std::filebuf wBuf;
-
-        //now open the output file to begin writing to it
-        if (wBuf.open(wFile, std::ios::out | std::ios::binary))
-        {
-            //connect to the output file
-            std::ostream wStream(&wBuf);
-
-            //re-open the input file to begin compression
-            if (rBuf.open(rFile, std::ios::in | std::ios::binary))
-            {
-                //connect to the input file
-                std::istream rStream(&rBuf);
-
-                //write the output file
-                codeTree.compress(wStream, rStream);
-            }
-
-            //close the input file buffer
-            rBuf.close();
-        }
-        else
-            //notify user that the output file couldn't be opened
-            std::cerr << "Error. " << wFile << " couldn't be opened. Compression failed." << std::endl;
-
-        //close the output file buffer
-        wBuf.close();
-    }
-
-    return 0;
-}
+#include "HCTree.hpp"
+#include "BitInputStream.hpp"
+#include "BlockCoder.hpp"
+#include "BatchCoder.hpp"
+#include "ContextCoder.hpp"
+#include "MappedFile.hpp"
+#include "Stats.hpp"
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <cstdlib>
+#include <sys/stat.h>
+
+/** Parse a size in bytes with an optional K or M suffix
+ */
+static size_t parseSize(const string& arg)
+{
+    //read the number and scale it by the suffix
+    char* end;
+    size_t size = strtoul(arg.c_str(), &end, 10);
+    if (*end == 'K' || *end == 'k')
+        size *= 1024;
+    else if (*end == 'M' || *end == 'm')
+        size *= 1024 * 1024;
+
+    return size;
+}
+
+/** Check if a file can be read twice, which the two pass format needs.
+ *  "-" stands for the standard input, which can't.
+ */
+static bool isRegularFile(const string& file)
+{
+    struct stat st;
+    return file != "-" && stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+/** Compress rFile into wFile in the blocked format with the given coder.
+ *  "-" for rFile reads the standard input, "-" for wFile writes the
+ *  standard output.
+ */
+static void compressBlocked(const string& rFile, const string& wFile, BlockCoder& coder)
+{
+    // map the input file, or else create file buffers for the input file
+    // and the output file
+    MappedFile rMap(rFile);
+    std::filebuf rBuf, wBuf;
+
+    // if we can't open the input file with the file buffer
+    if (!rMap.isMapped() && rFile != "-" && !rBuf.open(rFile, std::ios::in | std::ios::binary))
+        std::cerr << "Error. " << rFile << " couldn't be opened. Compression failed." << std::endl;
+    //if we can't open the output file
+    else if (wFile != "-" && !wBuf.open(wFile, std::ios::out | std::ios::binary))
+        std::cerr << "Error. " << wFile << " couldn't be opened. Compression failed." << std::endl;
+    else
+    {
+        //connect to the files, or to the standard streams
+        std::istream rStream(rFile == "-" ? std::cin.rdbuf() : &rBuf);
+        std::ostream wStream(wFile == "-" ? std::cout.rdbuf() : &wBuf);
+
+        //a mapped file is compressed in place, anything else is
+        //read only once, a block at a time
+        if (rMap.isMapped())
+            coder.compress(wStream, rMap.data(), rMap.size());
+        else
+            coder.compress(wStream, rStream);
+    }
+}
+
+/** Load the shared table in the table file tableFile into codeTree.
+ *  Return false if it can't be read or isn't a table file.
+ */
+static bool loadTable(const string& tableFile, HCTree& codeTree)
+{
+    std::filebuf tBuf;
+    if (!tBuf.open(tableFile, std::ios::in | std::ios::binary))
+        return false;
+    std::istream tStream(&tBuf);
+    BitInputStream in(tStream);
+    return codeTree.readTable(in);
+}
+
+/** Compress rFile into wFile with the shared table loaded into
+ *  codeTree, without counting the bytes or writing a code header.
+ *  "-" for rFile reads the standard input, "-" for wFile writes the
+ *  standard output.
+ */
+static void compressShared(const string& rFile, const string& wFile, HCTree& codeTree)
+{
+    // map the input file, or else read all of it, as the file starts
+    // with its size
+    MappedFile rMap(rFile);
+    std::vector<byte> message;
+    std::filebuf rBuf, wBuf;
+    if (!rMap.isMapped())
+    {
+        if (rFile != "-" && !rBuf.open(rFile, std::ios::in | std::ios::binary))
+        {
+            std::cerr << "Error. " << rFile << " couldn't be opened. Compression failed." << std::endl;
+            return;
+        }
+        std::istream rStream(rFile == "-" ? std::cin.rdbuf() : &rBuf);
+        message.assign(std::istreambuf_iterator<char>(rStream), std::istreambuf_iterator<char>());
+    }
+
+    //if we can't open the output file
+    if (wFile != "-" && !wBuf.open(wFile, std::ios::out | std::ios::binary))
+        std::cerr << "Error. " << wFile << " couldn't be opened. Compression failed." << std::endl;
+    else
+    {
+        //code the bytes with the table straight away
+        std::ostream wStream(wFile == "-" ? std::cout.rdbuf() : &wBuf);
+        BitOutputStream out(wStream);
+        if (rMap.isMapped())
+            codeTree.compressShared(out, rMap.data(), rMap.size());
+        else
+            codeTree.compressShared(out, message.data(), message.size());
+    }
+}
+
+/** Compress rFile into wFile in the order-1 context format with the
+ *  given coder. "-" for rFile reads the standard input, "-" for wFile
+ *  writes the standard output.
+ */
+static void compressContext(const string& rFile, const string& wFile, ContextCoder& coder)
+{
+    // map the input file, or else read all of it, as the codes are
+    // built before anything is coded
+    MappedFile rMap(rFile);
+    std::vector<byte> message;
+    std::filebuf rBuf, wBuf;
+    if (!rMap.isMapped())
+    {
+        if (rFile != "-" && !rBuf.open(rFile, std::ios::in | std::ios::binary))
+        {
+            std::cerr << "Error. " << rFile << " couldn't be opened. Compression failed." << std::endl;
+            return;
+        }
+        std::istream rStream(rFile == "-" ? std::cin.rdbuf() : &rBuf);
+        message.assign(std::istreambuf_iterator<char>(rStream), std::istreambuf_iterator<char>());
+    }
+    const byte* src = rMap.isMapped() ? rMap.data() : message.data();
+    size_t n = rMap.isMapped() ? rMap.size() : message.size();
+
+    //if we can't open the output file
+    if (wFile != "-" && !wBuf.open(wFile, std::ios::out | std::ios::binary))
+        std::cerr << "Error. " << wFile << " couldn't be opened. Compression failed." << std::endl;
+    else
+    {
+        //build the codes of the contexts, then code the bytes with them
+        std::ostream wStream(wFile == "-" ? std::cout.rdbuf() : &wBuf);
+        BitOutputStream out(wStream);
+        coder.build(src, n);
+        coder.compress(out, src, n);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    //separate the options from the file names in the input arguments
+    std::vector<string> files;
+    int maxLength = HCTree::MAX_HEADER_CODE_LENGTH;
+    size_t blockSize = BlockCoder::DEFAULT_BLOCK_SIZE;
+    int threads = 1;
+    bool threadsGiven = false;
+    size_t memoryLimit = 0;
+    int countThreads = 1;
+    bool splitStreams = false;
+    bool blocked = false;
+    bool showStats = false;
+    bool checksums = false;
+    bool indexed = false;
+    bool batch = false;
+    string tableFile;
+    int contextTables = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+
+        //-L N limits codes to N bits, 0 for plain Huffman codes
+        if (arg == "-L" && i + 1 < argc)
+            maxLength = atoi(argv[++i]);
+        //-b SIZE writes the blocked format with blocks of SIZE bytes
+        else if (arg == "-b" && i + 1 < argc)
+        {
+            blockSize = parseSize(argv[++i]);
+            blocked = true;
+        }
+        //-T N writes the blocked format using N threads, 0 for all cores
+        else if (arg == "-T" && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+            threadsGiven = true;
+            blocked = true;
+        }
+        //-C N counts the bytes of a single-table file on N threads, 0 for all cores
+        else if (arg == "-C" && i + 1 < argc)
+            countThreads = atoi(argv[++i]);
+        //-S writes the blocked format with every block split into 4 streams
+        else if (arg == "-S")
+        {
+            splitStreams = true;
+            blocked = true;
+        }
+        //-m SIZE writes the blocked format using at most SIZE bytes for blocks
+        else if (arg == "-m" && i + 1 < argc)
+        {
+            memoryLimit = parseSize(argv[++i]);
+            blocked = true;
+        }
+        //--checksum writes the blocked format with a CRC32C for every block
+        else if (arg == "--checksum")
+        {
+            checksums = true;
+            blocked = true;
+        }
+        //--index writes the blocked format ending with an index of the
+        //blocks, so uncompress --range can decode just part of the file
+        else if (arg == "--index")
+        {
+            indexed = true;
+            blocked = true;
+        }
+        //--batch compresses the pairs of files listed in a file, or
+        //every file of a directory into another directory
+        else if (arg == "--batch")
+            batch = true;
+        //--context N codes every byte with a code picked by the byte
+        //before it, with at most N codes (1 to 256)
+        else if (arg == "--context" && i + 1 < argc)
+            contextTables = atoi(argv[++i]);
+        //--table F codes with the shared table in F that train wrote
+        else if (arg == "--table" && i + 1 < argc)
+            tableFile = argv[++i];
+        //--stats prints where the time went and what the code looks like
+        else if (arg == "--stats")
+            showStats = true;
+        else
+            files.push_back(arg);
+    }
+
+    //the stats are kept from here on, but only printed if asked for
+    Stats stats;
+    double start = Stats::now();
+
+    //load the shared table before anything is coded with it
+    HCTree table;
+    table.setStats(&stats);
+    if (!tableFile.empty() && !loadTable(tableFile, table))
+    {
+        std::cerr << "Error. " << tableFile << " isn't a table file. Compression failed." << std::endl;
+        return 1;
+    }
+
+    //notify user if the right number of arguments weren't provided
+    if (files.size() != 2 && !(batch && files.size() == 1))
+        std::cout << "You need to provide 2 input arguments for this program." << std::endl;
+    //a batch of files is compressed on one pool of threads, all cores
+    //unless -T says otherwise
+    else if (batch)
+    {
+        std::vector<BatchCoder::Task> tasks;
+        bool listed = files.size() == 1 ? BatchCoder::readList(files[0], tasks)
+                                        : BatchCoder::readDirectory(files[0], files[1], tasks);
+        if (!listed)
+        {
+            std::cerr << "Error. The batch couldn't be read. Compression failed." << std::endl;
+            return 1;
+        }
+
+        BatchCoder coder(threadsGiven ? threads : 0, maxLength);
+        coder.setStats(&stats);
+        if (!tableFile.empty())
+            coder.setTable(&table);
+        size_t failed = coder.run(tasks, true);
+        if (showStats)
+        {
+            stats.finish(start);
+            stats.print(std::cerr, true);
+        }
+        return failed == 0 ? 0 : 1;
+    }
+    //a shared table needs neither a count of the bytes nor a header
+    else if (!tableFile.empty())
+        compressShared(files[0], files[1], table);
+    //the context format has a code per cluster of contexts
+    else if (contextTables > 0)
+    {
+        ContextCoder coder(contextTables, maxLength);
+        coder.setStats(&stats);
+        compressContext(files[0], files[1], coder);
+    }
+    //compress in the blocked format if asked to, or if the input
+    //is a pipe or the standard input and can only be read once
+    else if (blocked || !isRegularFile(files[0]))
+    {
+        //don't let stdio slow down the standard streams
+        std::ios::sync_with_stdio(false);
+
+        BlockCoder coder(blockSize, threads, maxLength);
+        coder.setMemoryLimit(memoryLimit);
+        coder.setSplitStreams(splitStreams);
+        coder.setChecksums(checksums);
+        coder.setIndex(indexed);
+        coder.setStats(&stats);
+        compressBlocked(files[0], files[1], coder);
+    }
+    else
+    {
+        //set filenames to process from input argument
+        string rFile = files[0], wFile = files[1];
+
+        // map the input file, so both passes read it in place
+        MappedFile rMap(rFile);
+
+        // create a file buffer for the input file
+        std::filebuf rBuf;
+
+        //create a huffman tree
+        HCTree codeTree;
+        codeTree.setCodeLengthLimit(maxLength);
+        codeTree.setStats(&stats);
+
+        //create a vectors of ints to store the frequencies of the bytes
+        //in the input file
+        std::vector<long> freqs(256);
+
+        //if the input file is mapped, build the Huffman tree from its bytes
+        if (rMap.isMapped())
+            codeTree.build(freqs, rMap.data(), rMap.size(), countThreads);
+        // if we can open the input file with the file buffer
+        else if (rBuf.open(rFile, std::ios::in | std::ios::binary))
+        {
+
+            //connect to the input file
+            std::istream rStream(&rBuf);
+
+            //build the Huffman tree from the input file
+            codeTree.build(freqs, rStream);
+
+            //close the input file buffer
+            rBuf.close();
+        }
+        else
+            // notify user that the input file couldn't be opened
+            std::cerr << "Error. " << rFile << " couldn't be opened. Compression failed." << std::endl;
+
+        // create a 2nd file buffer for the output file
+        std::filebuf wBuf;
+
+        //now open the output file to begin writing to it, "-" writes
+        //the standard output
+        if (wFile == "-" || wBuf.open(wFile, std::ios::out | std::ios::binary))
+        {
+            //connect to the output file
+            std::ostream wStream(wFile == "-" ? std::cout.rdbuf() : &wBuf);
+
+            //compress the mapped bytes in place
+            if (rMap.isMapped())
+                codeTree.compress(wStream, rMap.data(), rMap.size());
+            //or re-open the input file to begin compression
+            else if (rBuf.open(rFile, std::ios::in | std::ios::binary))
+            {
+                //connect to the input file
+                std::istream rStream(&rBuf);
+
+                //write the output file
+                codeTree.compress(wStream, rStream);
+            }
+
+            //close the input file buffer
+            rBuf.close();
+        }
+        else
+            //notify user that the output file couldn't be opened
+            std::cerr << "Error. " << wFile << " couldn't be opened. Compression failed." << std::endl;
+
+        //close the output file buffer
+        wBuf.close();
+    }
+
+    //print the stats to the standard error, the standard output may be the compressed file
+    if (showStats && files.size() == 2)
+    {
+        stats.finish(start);
+        stats.print(std::cerr, true);
+    }
+
+    return 0;
+}
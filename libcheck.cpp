@@ -0,0 +1,145 @@
+#include "Huffman.hpp"
+#include "Compressor.hpp"
+#include "Decompressor.hpp"
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+/** Number of checks that failed so far
+ */
+static int failures = 0;
+
+/** Count a failed check named name if ok isn't set
+ */
+static void check(bool ok, const std::string& name)
+{
+    if (!ok)
+    {
+        std::cout << "FAILED: " << name << std::endl;
+        failures++;
+    }
+}
+
+/** Read all of the file named path into bytes.
+ *  Return false if it can't be read.
+ */
+static bool readFile(const std::string& path, std::vector<uint8_t>& bytes)
+{
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    if (!file)
+        return false;
+    bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return true;
+}
+
+/** Round trip the n bytes at src through huffman::compress and
+ *  huffman::decompress, and check that buffers one byte too small fail.
+ */
+static void checkMessage(const uint8_t* src, size_t n, const std::string& name)
+{
+    //compress into a buffer of the bound, then into one just too small
+    std::vector<uint8_t> coded(huffman::compressBound(n));
+    size_t codedSize = huffman::compress(src, n, coded.data(), coded.size());
+    check(codedSize != huffman::FAILED && codedSize <= coded.size(), name + ": compress");
+    if (codedSize == huffman::FAILED)
+        return;
+    std::vector<uint8_t> small(codedSize - 1);
+    check(huffman::compress(src, n, small.data(), small.size()) == huffman::FAILED,
+          name + ": compress into too small a buffer");
+
+    //the size is in the header, and the message comes back
+    check(huffman::decompressedSize(coded.data(), codedSize) == n, name + ": decompressedSize");
+    std::vector<uint8_t> message(n + 1);
+    size_t messageSize = huffman::decompress(coded.data(), codedSize, message.data(), n);
+    check(messageSize == n && std::equal(src, src + n, message.begin()), name + ": decompress");
+    if (n > 0)
+        check(huffman::decompress(coded.data(), codedSize, message.data(), n - 1) == huffman::FAILED,
+              name + ": decompress into too small a buffer");
+}
+
+/** Return the size of the i-th of the uneven pieces a file is fed in,
+ *  from a single byte to more than a 4K block
+ */
+static size_t pieceSize(size_t i)
+{
+    static const size_t SIZES[] = { 1, 7, 2, 300, 4099, 3, 1000 };
+    return SIZES[i % (sizeof(SIZES) / sizeof(SIZES[0]))];
+}
+
+/** Feed the n bytes of the blocked file at src to a Decompressor in
+ *  uneven pieces, and check that they decompress to message.
+ */
+static void checkDecompressor(const uint8_t* src, size_t n, const std::vector<uint8_t>& message)
+{
+    Decompressor decompressor;
+    std::vector<uint8_t> decoded;
+    for (size_t pos = 0, i = 0; pos < n; i++)
+    {
+        size_t take = std::min(pieceSize(i), n - pos);
+        const std::vector<byte>& out = decompressor.update(reinterpret_cast<const char*>(src + pos), take);
+        decoded.insert(decoded.end(), out.begin(), out.end());
+        pos += take;
+    }
+    check(decompressor.finish() && decoded == message, "Decompressor of a blocked file in pieces");
+
+    //a block size that never ends is damage, not a wait for more input
+    Decompressor damaged;
+    std::vector<char> endless(src, src + 4);
+    endless.resize(64, (char)0xff);
+    damaged.update(endless.data(), endless.size());
+    check(damaged.failed() && !damaged.finish(), "Decompressor of a varint that never ends");
+}
+
+/** Feed message to a Compressor with 4K blocks in uneven pieces, and
+ *  check that it writes the same file as compress -b 4K, which is the
+ *  n bytes at file.
+ */
+static void checkCompressor(const std::vector<uint8_t>& message, const uint8_t* file, size_t n)
+{
+    Compressor compressor(4096);
+    std::vector<uint8_t> coded;
+    for (size_t pos = 0, i = 0; pos < message.size(); i++)
+    {
+        size_t take = std::min(pieceSize(i), message.size() - pos);
+        const std::vector<char>& out = compressor.update(&message[pos], take);
+        coded.insert(coded.end(), out.begin(), out.end());
+        pos += take;
+    }
+    const std::vector<char>& out = compressor.finish();
+    coded.insert(coded.end(), out.begin(), out.end());
+    check(coded.size() == n && std::equal(coded.begin(), coded.end(), file),
+          "Compressor in pieces writes what compress -b 4K does");
+}
+
+int main(int argc, char* argv[])
+{
+    //notify user if the right number of arguments weren't provided
+    if (argc != 3)
+    {
+        std::cout << "You need to provide a message file and the file compress -b 4K wrote for it." << std::endl;
+        return 1;
+    }
+
+    std::vector<uint8_t> message, blocked;
+    if (!readFile(argv[1], message) || !readFile(argv[2], blocked))
+    {
+        std::cerr << "Error. " << argv[1] << " or " << argv[2] << " couldn't be read." << std::endl;
+        return 1;
+    }
+
+    //the library round trips the message, an empty one and a single
+    //repeated byte
+    checkMessage(message.data(), message.size(), "message");
+    checkMessage(message.data(), 0, "empty message");
+    std::vector<uint8_t> repeated(1000, 'a');
+    checkMessage(repeated.data(), repeated.size(), "repeated byte");
+
+    //the push interface reads and writes the blocked files of the tools
+    checkDecompressor(blocked.data(), blocked.size(), message);
+    checkCompressor(message, blocked.data(), blocked.size());
+
+    return failures == 0 ? 0 : 1;
+}
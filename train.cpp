@@ -0,0 +1,96 @@
+#include "HCTree.hpp"
+#include "BitOutputStream.hpp"
+#include "MappedFile.hpp"
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/** Add the counts of the bytes of the file or the regular files of the
+ *  directory named path to freqs.
+ *  Return false if it can't be read.
+ */
+static bool countSample(const string& path, std::vector<long>& freqs)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+
+    //a directory adds the files in it, but not its subdirectories
+    if (S_ISDIR(st.st_mode))
+    {
+        DIR* dir = opendir(path.c_str());
+        if (dir == nullptr)
+            return false;
+        bool ok = true;
+        for (struct dirent* entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+        {
+            string file = path + "/" + entry->d_name;
+            if (stat(file.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+                ok = countSample(file, freqs) && ok;
+        }
+        closedir(dir);
+        return ok;
+    }
+
+    //count the mapped bytes in place
+    MappedFile rMap(path);
+    if (!rMap.isMapped())
+        return false;
+    HCTree::charCount(freqs, rMap.data(), rMap.size());
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    //separate the options from the file names in the input arguments
+    std::vector<string> files;
+    int maxLength = HCTree::MAX_HEADER_CODE_LENGTH;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+
+        //-L N limits codes to N bits, at most 15
+        if (arg == "-L" && i + 1 < argc)
+            maxLength = atoi(argv[++i]);
+        else
+            files.push_back(arg);
+    }
+
+    //notify user if the right number of arguments weren't provided
+    if (files.size() < 2)
+    {
+        std::cout << "You need to provide a table file and at least 1 sample file for this program." << std::endl;
+        return 1;
+    }
+
+    //count the bytes of all the samples together
+    std::vector<long> freqs(256);
+    for (size_t i = 1; i < files.size(); i++)
+    {
+        if (!countSample(files[i], freqs))
+        {
+            std::cerr << "Error. " << files[i] << " couldn't be read. Training failed." << std::endl;
+            return 1;
+        }
+    }
+
+    //build a code that has room for every byte, then write it out
+    HCTree codeTree;
+    codeTree.setCodeLengthLimit(maxLength);
+    codeTree.train(freqs);
+
+    std::filebuf wBuf;
+    if (!wBuf.open(files[0], std::ios::out | std::ios::binary))
+    {
+        std::cerr << "Error. " << files[0] << " couldn't be opened. Training failed." << std::endl;
+        return 1;
+    }
+    std::ostream wStream(&wBuf);
+    BitOutputStream out(wStream);
+    codeTree.writeTable(out);
+    wBuf.close();
+
+    return 0;
+}
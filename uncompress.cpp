@@ -1,69 +1,374 @@
-#include "HCTree.hpp"
-#include "BitInputStream.hpp"
-#include <iostream>
-#include <fstream>
-#include <cstdlib>
-
-int main(int argc, char* argv[])
-{
-    //notify user if the right number of arguments weren't provided
-    if (argc != 3)
-        std::cout << "You need to provide 2 input arguments for this program." << std::endl;
-    else
-    {
-
-        //set filenames to process from input argument
-        string rFile = argv[1], wFile = argv[2];
-
-        // create a file buffer to the input file
-        std::filebuf rBuf;
-
-        //create a huffman tree
-        HCTree codeTree;
-
-        //if we can open the input file with the file buffer
-        if (rBuf.open(rFile, std::ios::in | std::ios::binary))
-        {
-            //connect to the input file
-            std::istream rStream(&rBuf);
-
-            //create a vectors of ints to store the frequency of
-            //bytes that occurred in the original uncompressed file
-            //(bytes and frequencies will be obtained from the input file
-            //header section)
-            std::vector<long> freqs(256);
-
-            //build the Huffman code tree
-            codeTree.build2(freqs, rStream);
-
-            // create a 2nd file buffer for the output file
-            std::filebuf wBuf;
-
-            //now try and open the output file
-            if (wBuf.open(wFile, std::ios::out | std::ios::binary))
-            {
-                //connect to the output file
-                std::ostream wStream(&wBuf);
-
-                //uncompress the input file into the output file
-                codeTree.decompress(wStream, rStream);
-
-                //close the file buffer for the output file
-                wBuf.close();
-            }
-            else
-                //notify user that the file couldn't be opened and thus uncompression failed
-                std::cerr << "Error. " << wFile << " couldn't be opened.\nUncompression of " << rFile << " failed." << std::endl;
-
-            //close the input file buffer
-            rBuf.close();
-
-        }
-        else
-            // notify user that the file couldn't be opened
-            std::cerr << "Error. " << rFile << " couldn't be opened. Uncompression failed." << std::endl;
-
-    }
-
-    return 0;
-}
+#include "HCTree.hpp"
+#include "BitInputStream.hpp"
+#include "BlockCoder.hpp"
+#include "BlockReader.hpp"
+#include "BatchCoder.hpp"
+#include "ContextCoder.hpp"
+#include "MappedFile.hpp"
+#include "Stats.hpp"
+#include <iostream>
+#include <fstream>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/** Uncompress the blocks of the blocked file rFile, read through in,
+ *  into wFile using the given number of threads, adding to stats.
+ *  An empty wFile only decodes and checks the blocks, "-" writes the
+ *  standard output.
+ *  format is the blocked format version rFile is in.
+ *  Return false if uncompression failed.
+ */
+static bool uncompressBlocked(const string& rFile, const string& wFile, BitInputStream& in, int threads,
+                              int format, Stats& stats)
+{
+    //open the output file for positional writes from the worker threads,
+    //"-" writes the standard output
+    int fd = wFile.empty() ? -1 : wFile == "-" ? STDOUT_FILENO : open(wFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 && !wFile.empty())
+    {
+        //notify user that the file couldn't be opened and thus uncompression failed
+        std::cerr << "Error. " << wFile << " couldn't be opened.\nUncompression of " << rFile << " failed." << std::endl;
+        return false;
+    }
+
+    //uncompress the input file into the output file
+    BlockCoder coder(BlockCoder::DEFAULT_BLOCK_SIZE, threads);
+    coder.setSplitStreams((format & ~(HCTree::FORMAT_CHECKSUM | HCTree::FORMAT_INDEX)) == HCTree::FORMAT_STREAMS);
+    coder.setChecksums((format & HCTree::FORMAT_CHECKSUM) != 0);
+    coder.setStats(&stats);
+    bool ok = coder.decompress(fd, in);
+    if (!ok)
+        std::cerr << "Error. " << rFile << " is truncated or damaged. Uncompression failed." << std::endl;
+
+    //close the output file
+    if (fd >= 0 && fd != STDOUT_FILENO)
+        close(fd);
+
+    return ok;
+}
+
+/** Load the shared table in the table file tableFile into codeTree.
+ *  Return false if it can't be read or isn't a table file.
+ */
+static bool loadTable(const string& tableFile, HCTree& codeTree)
+{
+    std::filebuf tBuf;
+    if (!tBuf.open(tableFile, std::ios::in | std::ios::binary))
+        return false;
+    std::istream tStream(&tBuf);
+    BitInputStream in(tStream);
+    return codeTree.readTable(in);
+}
+
+/** Uncompress the compressed file rFile, read through in, into wFile,
+ *  adding to stats. An empty wFile only decodes and checks the file,
+ *  "-" writes the standard output.
+ *  table is the shared table files may be coded with, if any.
+ *  Return false if uncompression failed.
+ */
+static bool uncompressFrom(const string& rFile, const string& wFile, BitInputStream& in, int threads,
+                           const HCTree* table, Stats& stats)
+{
+    //find out which format the input file is in
+    int format = HCTree::readFormat(in);
+
+    //create a huffman tree, a file coded with a shared table starts
+    //out with the table
+    HCTree codeTree;
+    if (format == HCTree::FORMAT_SHARED && table != nullptr)
+        codeTree = *table;
+    codeTree.setStats(&stats);
+
+    //create a vectors of ints to store the frequency of
+    //bytes that occurred in the original uncompressed file
+    //(bytes and frequencies will be obtained from the input file
+    //header section)
+    std::vector<long> freqs(256);
+
+    //build the Huffman code tree, blocked files instead
+    //carry a code in every block, and maybe a checksum and an index
+    int version = format & ~(HCTree::FORMAT_CHECKSUM | HCTree::FORMAT_INDEX);
+    bool blocked = (version == HCTree::FORMAT_BLOCKED || version == HCTree::FORMAT_STREAMS);
+    bool known = blocked || codeTree.build2(freqs, in, format);
+    bool ok = false;
+
+    // create a file buffer for the output file
+    std::filebuf wBuf;
+
+    //the context format has its own header and codes
+    ContextCoder contextCoder;
+    contextCoder.setStats(&stats);
+    bool context = (format == HCTree::FORMAT_CONTEXT);
+    if (context)
+        known = contextCoder.readHeader(in);
+
+    //notify user if the input file needs a table it wasn't given
+    if (!known && format == HCTree::FORMAT_SHARED)
+        std::cerr << "Error. " << rFile << " was compressed with a shared table, and "
+                  << (table ? "not the one given" : "needs --table") << ". Uncompression failed." << std::endl;
+    //notify user if the input file is in a format we don't know
+    else if (!known)
+        std::cerr << "Error. " << rFile << " uses an unknown format version. Uncompression failed." << std::endl;
+    //blocked files are written by several threads at once
+    else if (blocked)
+        ok = uncompressBlocked(rFile, wFile, in, threads, format, stats);
+    //a file that is only checked is decoded into a stream that drops everything
+    else if (wFile.empty())
+    {
+        std::ostream nullStream(nullptr);
+        if (context)
+            contextCoder.decompress(nullStream, in);
+        else
+            codeTree.decompress(nullStream, in);
+        ok = true;
+    }
+    //now try and open the output file, "-" writes the standard output
+    else if (wFile == "-" || wBuf.open(wFile, std::ios::out | std::ios::binary))
+    {
+        //connect to the output file
+        std::ostream wStream(wFile == "-" ? std::cout.rdbuf() : &wBuf);
+
+        //uncompress the input file into the output file
+        if (context)
+            contextCoder.decompress(wStream, in);
+        else
+            codeTree.decompress(wStream, in);
+        ok = true;
+
+        //close the file buffer for the output file
+        wBuf.close();
+    }
+    else
+        //notify user that the file couldn't be opened and thus uncompression failed
+        std::cerr << "Error. " << wFile << " couldn't be opened.\nUncompression of " << rFile << " failed." << std::endl;
+
+    //tell how much checking found the file intact
+    if (ok && wFile.empty())
+    {
+        if (format & HCTree::FORMAT_CHECKSUM)
+            std::cout << rFile << ": OK" << std::endl;
+        else
+            std::cout << rFile << ": OK, decoded but it has no checksums to check" << std::endl;
+    }
+
+    return ok;
+}
+
+/** Uncompress the bytes of the message of the blocked file rFile from
+ *  offset from up to offset to, or up to its end, into wFile, decoding
+ *  only the blocks that cover them. "-" for wFile writes the standard
+ *  output.
+ *  Return false if uncompression failed.
+ */
+static bool uncompressRange(const string& rFile, const string& wFile, uint64_t from, uint64_t to)
+{
+    //the blocks are read in place, so the file has to be mapped
+    MappedFile rMap(rFile);
+    if (!rMap.isMapped())
+    {
+        std::cerr << "Error. " << rFile << " couldn't be mapped. Uncompression failed." << std::endl;
+        return false;
+    }
+    BlockReader reader(rMap.data(), rMap.size());
+    if (!reader.isValid())
+    {
+        std::cerr << "Error. " << rFile << " isn't a blocked file, or is damaged. Uncompression failed." << std::endl;
+        return false;
+    }
+
+    //a range running past the end stops at the end
+    to = std::min(to, reader.messageSize());
+    if (from > to)
+    {
+        std::cerr << "Error. " << rFile << " has only " << reader.messageSize() << " bytes. Uncompression failed."
+                  << std::endl;
+        return false;
+    }
+
+    std::filebuf wBuf;
+    if (wFile != "-" && !wBuf.open(wFile, std::ios::out | std::ios::binary))
+    {
+        //notify user that the file couldn't be opened and thus uncompression failed
+        std::cerr << "Error. " << wFile << " couldn't be opened.\nUncompression of " << rFile << " failed." << std::endl;
+        return false;
+    }
+    std::ostream wStream(wFile == "-" ? std::cout.rdbuf() : &wBuf);
+
+    //decode a large range a piece at a time, so it needn't fit in memory
+    const uint64_t PIECE = 16 * 1024 * 1024;
+    std::vector<byte> piece(std::min(PIECE, to - from));
+    bool ok = true;
+    while (ok && from < to)
+    {
+        uint64_t n = std::min(PIECE, to - from);
+        ok = reader.read(from, from + n, piece.data());
+        if (ok)
+            ok = (bool)wStream.write(reinterpret_cast<const char*>(piece.data()), n);
+        from += n;
+    }
+    wStream.flush();
+    if (!ok)
+        std::cerr << "Error. " << rFile << " is damaged, or " << wFile << " couldn't be written. Uncompression failed."
+                  << std::endl;
+
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    //separate the options from the file names in the input arguments
+    std::vector<string> files;
+    int threads = 1;
+    bool threadsGiven = false;
+    bool batch = false;
+    string tableFile;
+    bool showStats = false;
+    bool verify = false;
+    bool range = false;
+    uint64_t from = 0, to = UINT64_MAX;
+    bool ok = false;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+
+        //-T N decodes blocked files on N threads, 0 for all cores
+        if (arg == "-T" && i + 1 < argc)
+        {
+            threads = atoi(argv[++i]);
+            threadsGiven = true;
+        }
+        //--stats prints where the time went and what the code looks like
+        else if (arg == "--stats")
+            showStats = true;
+        //--verify decodes the file and checks its checksums without writing anything
+        else if (arg == "--verify")
+            verify = true;
+        //--batch uncompresses the pairs of files listed in a file, or
+        //every file of a directory into another directory
+        else if (arg == "--batch")
+            batch = true;
+        //--table F decodes files coded with the shared table in F
+        else if (arg == "--table" && i + 1 < argc)
+            tableFile = argv[++i];
+        //--range X:Y writes only bytes X up to Y of the message of a
+        //blocked file, Y left out for the end, decoding only the blocks
+        //that cover them
+        else if (arg == "--range" && i + 1 < argc)
+        {
+            char* end;
+            from = strtoull(argv[++i], &end, 10);
+            if (*end == ':' && end[1] != '\0')
+                to = strtoull(end + 1, &end, 10);
+            range = true;
+        }
+        else
+            files.push_back(arg);
+    }
+
+    //load the shared table before anything is decoded with it
+    HCTree table;
+    if (!tableFile.empty() && !loadTable(tableFile, table))
+    {
+        std::cerr << "Error. " << tableFile << " isn't a table file. Uncompression failed." << std::endl;
+        return 1;
+    }
+    const HCTree* shared = tableFile.empty() ? nullptr : &table;
+
+    //a batch of files is uncompressed on one pool of threads, all cores
+    //unless -T says otherwise
+    if (batch && (files.size() == 1 || files.size() == 2))
+    {
+        std::vector<BatchCoder::Task> tasks;
+        bool listed = files.size() == 1 ? BatchCoder::readList(files[0], tasks)
+                                        : BatchCoder::readDirectory(files[0], files[1], tasks);
+        if (!listed)
+        {
+            std::cerr << "Error. The batch couldn't be read. Uncompression failed." << std::endl;
+            return 1;
+        }
+
+        Stats stats;
+        double start = Stats::now();
+        BatchCoder coder(threadsGiven ? threads : 0);
+        coder.setStats(&stats);
+        coder.setTable(shared);
+        size_t failed = coder.run(tasks, false);
+        if (showStats)
+        {
+            stats.finish(start);
+            stats.print(std::cerr, false);
+        }
+        return failed == 0 ? 0 : 1;
+    }
+
+    //notify user if the right number of arguments weren't provided
+    if (files.size() != (verify ? 1 : 2))
+        std::cout << "You need to provide " << (verify ? "1 input argument" : "2 input arguments")
+                  << " for this program." << std::endl;
+    else
+    {
+
+        //set filenames to process from input argument, a file that is
+        //only checked isn't written anywhere
+        string rFile = files[0], wFile = verify ? "" : files[1];
+
+        //a range is read straight from the blocks that cover it
+        if (range)
+            return uncompressRange(rFile, wFile, from, to) ? 0 : 1;
+
+        //the stats are kept from here on, but only printed if asked for
+        Stats stats;
+        double start = Stats::now();
+
+        // map the input file, or else create a file buffer to it
+        MappedFile rMap(rFile);
+        std::filebuf rBuf;
+
+        //if the input file is mapped, decode its bytes in place
+        if (rMap.isMapped())
+        {
+            BitInputStream in(reinterpret_cast<const char*>(rMap.data()), rMap.size());
+            ok = uncompressFrom(rFile, wFile, in, threads, shared, stats);
+        }
+        //"-" decodes the standard input, a block at a time like any stream
+        else if (rFile == "-")
+        {
+            std::ios::sync_with_stdio(false);
+            BitInputStream in(std::cin);
+            ok = uncompressFrom(rFile, wFile, in, threads, shared, stats);
+        }
+        //if we can open the input file with the file buffer
+        else if (rBuf.open(rFile, std::ios::in | std::ios::binary))
+        {
+            //connect to the input file
+            std::istream rStream(&rBuf);
+
+            //read the header and the compressed data through the same
+            //bit stream, as it reads ahead of the header
+            BitInputStream in(rStream);
+            ok = uncompressFrom(rFile, wFile, in, threads, shared, stats);
+
+            //close the input file buffer
+            rBuf.close();
+        }
+        else
+            // notify user that the file couldn't be opened
+            std::cerr << "Error. " << rFile << " couldn't be opened. Uncompression failed." << std::endl;
+
+        //the whole input file is the compressed file
+        struct stat st;
+        if (stat(rFile.c_str(), &st) == 0)
+            stats.codedBytes = st.st_size;
+
+        //print the stats to the standard error
+        if (showStats)
+        {
+            stats.finish(start);
+            stats.print(std::cerr, false);
+        }
+    }
+
+    return ok ? 0 : 1;
+}